@@ -0,0 +1,225 @@
+//
+// micro and end to end benchmarks , run by "make bench" :
+//   bench data_dir classify [threads]
+// data_dir is made by gen_stlfr . every case prints its throughput , run two
+// builds on the same data to see a regression .
+// classify.cpp is built in without its main , so the cases call the same
+// code as classify .
+//
+#define CLASSIFY_NO_MAIN
+#include "../classify.cpp"
+#include <climits>
+#include <cstdlib>
+
+struct Timer {
+    std::chrono::steady_clock::time_point start ;
+    Timer() : start(std::chrono::steady_clock::now()) {}
+    double Seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// keep results alive , so the compiler can not drop the work
+volatile uint64_t g_sink ;
+
+void report(const std::string & name , double items , double seconds , double bytes = 0){
+    printf("%-28s %12.0f items/s %10.1f ns/item",name.c_str(),items/seconds,seconds*1e9/items);
+    if( bytes > 0 ) printf(" %10.1f MB/s",bytes/seconds/1e6);
+    printf("\n");
+    fflush(stdout);
+}
+
+// first max records of a fastq
+void loadReads(const std::string & file , size_t max ,
+        std::vector<std::string> & heads , std::vector<std::string> & seqs){
+    std::ifstream ifs(file);
+    std::string head , seq , plus , qual ;
+    while( heads.size() < max && std::getline(ifs,head) && std::getline(ifs,seq)
+            && std::getline(ifs,plus) && std::getline(ifs,qual) ) {
+        heads.push_back(head);
+        seqs.push_back(seq);
+    }
+    if( heads.empty() ) {
+        std::cerr<<"ERROR : no read in \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
+    }
+}
+
+// sequence of a fasta , lines joined
+std::string loadRef(const std::string & file){
+    std::ifstream ifs(file);
+    std::string line , ref ;
+    while( std::getline(ifs,line) )
+        if( ! line.empty() && line[0] != '>' ) ref += line ;
+    return ref ;
+}
+
+void benchBaseStr(const std::vector<std::string> & seqs){
+    Timer t ;
+    uint64_t sum = 0 , bytes = 0 ;
+    for( const auto & seq : seqs ) {
+        sum += BaseStr::str2BaseStr(seq).size();
+        bytes += seq.size();
+    }
+    report("BaseStr::str2BaseStr",seqs.size(),t.Seconds(),bytes);
+    g_sink += sum ;
+}
+
+void benchLegacyKmer(const std::vector<std::string> & seqs){
+    std::vector<std::vector<char> > bases ;
+    for( const auto & seq : seqs ) bases.push_back(BaseStr::str2BaseStr(seq));
+    Timer t ;
+    uint64_t kmers = 0 ;
+    for( const auto & base : bases ) {
+        auto ret = Kmer::chopRead2Kmer(base);
+        kmers += ret.size();
+        g_sink += ret.back().low ;
+    }
+    report("Kmer::chopRead2Kmer",kmers,t.Seconds());
+    std::vector<Kmer> words ;
+    for( size_t i = 0 ; i < bases.size() && words.size() < 100000 ; i ++ )
+        words.push_back(Kmer::str2Kmer(std::vector<char>(bases[i].begin(),bases[i].begin()+Kmer::overlap)));
+    Timer r ;
+    uint64_t sum = 0 ;
+    const int rounds = 100 ;
+    for( int i = 0 ; i < rounds ; i ++ )
+        for( const auto & word : words )
+            sum += Kmer::fastReverseComp(word,Kmer::overlap).low ;
+    report("Kmer::fastReverseComp",(double)words.size()*rounds,r.Seconds());
+    g_sink += sum ;
+}
+
+void benchParse(const std::vector<std::string> & heads){
+    Timer t ;
+    uint64_t sum = 0 ;
+    for( const auto & head : heads ) sum += parseName(head).size();
+    report("parseName",heads.size(),t.Seconds());
+    Timer b ;
+    for( const auto & head : heads ) sum += parseBarcode(head.data(),head.size());
+    report("parseBarcode",heads.size(),b.Seconds());
+    g_sink += sum ;
+}
+
+void benchBarcodeCache(const std::vector<std::string> & heads){
+    std::vector<barcode_t> barcodes ;
+    for( const auto & head : heads ) barcodes.push_back(parseBarcode(head.data(),head.size()));
+    BarcodeCache cache ;
+    Timer t ;
+    const int rounds = 10 ;
+    for( int r = 0 ; r < rounds ; r ++ )
+        for( size_t i = 0 ; i < barcodes.size() ; i ++ )
+            cache.IncrBarcodeHaps(barcodes[i],(int)( i % ( g_hap_num + 1 ) ) - 1);
+    report("BarcodeCache::IncrBarcodeHaps",(double)barcodes.size()*rounds,t.Seconds());
+    g_sink += cache.Size();
+}
+
+// every 4th kmer of species i is owned by haplotype i
+void benchLookup(const std::vector<std::string> & refs , const std::vector<std::string> & seqs){
+    KmerHapIndex<21> index ;
+    for( int i = 0 ; i < (int)refs.size() ; i ++ ) {
+        CanonicalKmerIterator<KmerT<21> > it(refs[i].data(),refs[i].size());
+        KmerT<21> kmer ;
+        for( long n = 0 ; it.Next(kmer) ; n ++ )
+            if( n % 4 == 0 ) index.table.Insert(kmer,i);
+    }
+    std::vector<int> vote(g_hap_num,0);
+    VoteStats stats ;
+    KmerSampling all ;
+    Timer t ;
+    for( const auto & seq : seqs ) index.Vote(seq.data(),seq.size(),vote,stats,all);
+    report("kmer lookup ( table )",stats.kmers,t.Seconds());
+    int hashes ;
+    index.BuildFilter(0.01,0,hashes);
+    VoteStats bloom ;
+    Timer b ;
+    for( const auto & seq : seqs ) index.Vote(seq.data(),seq.size(),vote,bloom,all);
+    report("kmer lookup ( bloom+table )",bloom.kmers,b.Seconds());
+    HapIndex * compact = index.Compact(16,g_hap_num);
+    VoteStats cstats ;
+    Timer c ;
+    for( const auto & seq : seqs ) compact->Vote(seq.data(),seq.size(),vote,cstats,all);
+    report("kmer lookup ( compact )",cstats.kmers,c.Seconds());
+    delete compact ;
+    g_sink += stats.hits + bloom.hits + cstats.hits + vote[0] ;
+}
+
+void benchFastq(const std::string & file , int threads){
+    struct stat st ;
+    stat(file.c_str(),&st);
+    Timer t ;
+    FastqChunkReader reader(OpenByteSource(file,threads));
+    FastqChunk chunk ;
+    uint64_t records = 0 , bases = 0 ;
+    while( reader.Next(chunk) ) {
+        records += chunk.num ;
+        for( int i = 0 ; i < chunk.num ; i ++ ) bases += chunk.records[i].seq.len ;
+    }
+    std::string name = file.substr(file.find_last_of('/')+1);
+    report("fastq parse "+name+" t"+std::to_string(threads),records,t.Seconds(),st.st_size);
+    g_sink += bases ;
+}
+
+void benchEndToEnd(const std::string & dir , const std::string & classify , int threads , int species){
+    std::string refs , t = std::to_string(threads);
+    for( int i = 0 ; i < species ; i ++ ) refs += " --ref s" + std::to_string(i) + ".fa" ;
+    std::string cd = "cd '" + dir + "' && '" + classify + "'" ;
+    Timer e ;
+    if( system((cd + " extract-unique" + refs + " --thread " + t
+                    + " --index bench.idx 2>extract_unique.log").c_str()) != 0 ) {
+        std::cerr<<"ERROR : extract-unique failed , see "<<dir<<"/extract_unique.log , exit ..."<<std::endl;
+        exit(1);
+    }
+    printf("%-28s %12.3f s\n","end to end extract-unique",e.Seconds());
+    struct stat st1 , st2 ;
+    stat((dir + "/read_1.fq.gz").c_str(),&st1);
+    stat((dir + "/read_2.fq").c_str(),&st2);
+    Timer c ;
+    if( system((cd + " --index bench.idx --read read_1.fq.gz --read read_2.fq --thread " + t
+                    + " >phased.barcodes 2>phased.log").c_str()) != 0 ) {
+        std::cerr<<"ERROR : classify failed , see "<<dir<<"/phased.log , exit ..."<<std::endl;
+        exit(1);
+    }
+    double s = c.Seconds();
+    printf("%-28s %12.3f s %10.1f MB/s of input\n","end to end classify",s,( st1.st_size + st2.st_size ) / s / 1e6);
+}
+
+int main(int argc , char ** argv){
+    if( argc < 3 ) {
+        std::cerr<<"Usage :\n\tbench data_dir classify [threads]"<<std::endl;
+        return -1;
+    }
+    TestAll();
+    std::string dir = argv[1];
+    char path[PATH_MAX];
+    if( realpath(argv[2],path) == NULL ) {
+        std::cerr<<"ERROR : no classify at \""<<argv[2]<<"\" , exit ..."<<std::endl;
+        return 1;
+    }
+    std::string classify(path);
+    int threads = argc > 3 ? atoi(argv[3]) : 4 ;
+    std::vector<std::string> refs ;
+    for( int i = 0 ; ; i ++ ) {
+        std::string file = dir + "/s" + std::to_string(i) + ".fa" ;
+        struct stat st ;
+        if( stat(file.c_str(),&st) != 0 ) break;
+        refs.push_back(loadRef(file));
+    }
+    if( refs.size() < 2 ) {
+        std::cerr<<"ERROR : no data in \""<<dir<<"\" , run gen_stlfr first , exit ..."<<std::endl;
+        return 1;
+    }
+    g_hap_num = refs.size();
+    Kmer::InitFilter(21);
+    std::vector<std::string> heads , seqs ;
+    loadReads(dir + "/read_1.fq",1000000,heads,seqs);
+    benchBaseStr(seqs);
+    benchLegacyKmer(seqs);
+    benchParse(heads);
+    benchBarcodeCache(heads);
+    benchLookup(refs,seqs);
+    benchFastq(dir + "/read_1.fq",1);
+    benchFastq(dir + "/read_1.fq.gz",1);
+    benchFastq(dir + "/read_1.fq.gz",threads);
+    benchEndToEnd(dir,classify,threads,refs.size());
+    return 0;
+}
@@ -0,0 +1,172 @@
+//
+// deterministic synthetic data for benchmarks :
+//   out/s<i>.fa      : random species references , the first --shared part
+//                      of every species is copied from species 0
+//   out/read_1.fq    : barcoded stLFR read pairs , read_2.fq is the mate ,
+//   out/read_2.fq      read_1.fq.gz is read_1.fq in gzip
+// every barcode picks one species and one long fragment , its read pairs
+// come from that fragment with some substitutions and N . the same
+// arguments always give the same files .
+//
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+struct SplitMix64 {
+    uint64_t state ;
+    explicit SplitMix64(uint64_t seed) : state(seed) {}
+    uint64_t Next(){
+        uint64_t z = ( state += 0x9E3779B97F4A7C15ULL );
+        z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL ;
+        z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL ;
+        return z ^ ( z >> 31 );
+    }
+    // [0,n)
+    uint64_t Below(uint64_t n) { return Next() % n ; }
+    // [0,1)
+    double Real() { return ( Next() >> 11 ) * ( 1.0 / 9007199254740992.0 ); }
+};
+
+static char revComp(char c){
+    switch(c){
+        case 'A' : return 'T';
+        case 'C' : return 'G';
+        case 'G' : return 'C';
+        case 'T' : return 'A';
+        default  : return 'N';
+    }
+}
+
+void printUsage(){
+    std::cerr<<"Usage :\n\tgen_stlfr --out dir [--species 4] [--genome 200000] [--shared 0.1]"<<std::endl;
+    std::cerr<<"\t\t[--barcodes 2000] [--pairs 20] [--read-len 100] [--fragment 20000]"<<std::endl;
+    std::cerr<<"\t\t[--error 0.005] [--n-rate 0.001] [--no-barcode 0.05] [--seed 1]"<<std::endl;
+}
+
+int main(int argc , char ** argv){
+    static struct option long_options[] = {
+        {"out",      required_argument, NULL, 'o'},
+        {"species",  required_argument, NULL, 's'},
+        {"genome",   required_argument, NULL, 'g'},
+        {"shared",   required_argument, NULL, 'S'},
+        {"barcodes", required_argument, NULL, 'b'},
+        {"pairs",    required_argument, NULL, 'p'},
+        {"read-len", required_argument, NULL, 'l'},
+        {"fragment", required_argument, NULL, 'f'},
+        {"error",    required_argument, NULL, 'e'},
+        {"n-rate",   required_argument, NULL, 'n'},
+        {"no-barcode",required_argument,NULL, 'B'},
+        {"seed",     required_argument, NULL, 'r'},
+        {"help",     no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    static char optstring[] = "o:s:g:S:b:p:l:f:e:n:B:r:h";
+    std::string out ;
+    int species = 4 , read_len = 100 ;
+    long genome = 200000 , barcodes = 2000 , pairs = 20 , fragment = 20000 ;
+    double shared = 0.1 , error = 0.005 , n_rate = 0.001 , no_barcode = 0.05 ;
+    uint64_t seed = 1 ;
+    while(1){
+        int c = getopt_long(argc, argv, optstring, long_options, NULL);
+        if (c<0) break;
+        switch (c){
+            case 'o': out = optarg ; break;
+            case 's': species = atoi(optarg); break;
+            case 'g': genome = atol(optarg); break;
+            case 'S': shared = atof(optarg); break;
+            case 'b': barcodes = atol(optarg); break;
+            case 'p': pairs = atol(optarg); break;
+            case 'l': read_len = atoi(optarg); break;
+            case 'f': fragment = atol(optarg); break;
+            case 'e': error = atof(optarg); break;
+            case 'n': n_rate = atof(optarg); break;
+            case 'B': no_barcode = atof(optarg); break;
+            case 'r': seed = strtoull(optarg,NULL,10); break;
+            case 'h':
+            default :
+                printUsage();
+                return -1;
+        }
+    }
+    int insert = read_len * 3 ;
+    if( out.empty() || species < 2 || genome < insert || read_len < 32
+            || shared < 0 || shared >= 1 || barcodes < 1 || barcodes > 1536L*1536*1536 ) {
+        printUsage();
+        return -1;
+    }
+    if( fragment > genome ) fragment = genome ;
+    if( fragment < insert ) fragment = insert ;
+    mkdir(out.c_str(),0755);
+    SplitMix64 rng(seed);
+    const char * bases = "ACGT" ;
+
+    // references
+    std::vector<std::string> refs(species);
+    long shared_len = genome * shared ;
+    for( int s = 0 ; s < species ; s ++ ) {
+        std::string & ref = refs[s];
+        ref.resize(genome);
+        for( long i = 0 ; i < genome ; i ++ )
+            ref[i] = ( s > 0 && i < shared_len ) ? refs[0][i] : bases[rng.Below(4)];
+        std::ofstream ofs(out + "/s" + std::to_string(s) + ".fa");
+        ofs<<">s"<<s<<'\n';
+        for( long i = 0 ; i < genome ; i += 80 )
+            ofs<<ref.substr(i,80)<<'\n';
+        if( ! ofs ) {
+            std::cerr<<"ERROR : failed to write reference into "<<out<<" , exit ..."<<std::endl;
+            return 1;
+        }
+    }
+
+    // reads
+    std::ofstream r1(out + "/read_1.fq") , r2(out + "/read_2.fq");
+    gzFile gz = gzopen((out + "/read_1.fq.gz").c_str(),"wb6");
+    if( gz == NULL ) {
+        std::cerr<<"ERROR : failed to open "<<out<<"/read_1.fq.gz , exit ..."<<std::endl;
+        return 1;
+    }
+    std::string quality(read_len,'F');
+    std::string seq1(read_len,'A') , seq2(read_len,'A') , record ;
+    long read_id = 0 ;
+    for( long b = 0 ; b < barcodes ; b ++ ) {
+        std::string barcode = rng.Real() < no_barcode ? std::string("0_0_0")
+            : std::to_string(b / 1536 / 1536 % 1536 + 1) + '_'
+            + std::to_string(b / 1536 % 1536 + 1) + '_' + std::to_string(b % 1536 + 1);
+        const std::string & ref = refs[rng.Below(species)];
+        long start = rng.Below(genome - fragment + 1);
+        for( long p = 0 ; p < pairs ; p ++ ) {
+            long pos = start + rng.Below(fragment - insert + 1);
+            for( int i = 0 ; i < read_len ; i ++ ) {
+                seq1[i] = ref[pos+i];
+                seq2[i] = revComp(ref[pos+insert-1-i]);
+            }
+            for( std::string * seq : { &seq1 , &seq2 } ) {
+                for( int i = 0 ; i < read_len ; i ++ ) {
+                    double x = rng.Real();
+                    if( x < n_rate ) (*seq)[i] = 'N' ;
+                    else if ( x < n_rate + error ) (*seq)[i] = bases[rng.Below(4)];
+                }
+            }
+            std::string head = "@bench_" + std::to_string(read_id++) + '#' + barcode ;
+            record = head + "/1\n" + seq1 + "\n+\n" + quality + '\n' ;
+            r1<<record ;
+            gzwrite(gz,record.data(),record.size());
+            r2<<head<<"/2\n"<<seq2<<"\n+\n"<<quality<<'\n' ;
+        }
+    }
+    r1.close();
+    r2.close();
+    if( gzclose(gz) != Z_OK || ! r1 || ! r2 ) {
+        std::cerr<<"ERROR : failed to write reads into "<<out<<" , exit ..."<<std::endl;
+        return 1;
+    }
+    std::cerr<<"Generated "<<species<<" references of "<<genome<<" bp and "
+        <<read_id<<" read pairs of "<<barcodes<<" barcodes into "<<out<<std::endl;
+    return 0;
+}
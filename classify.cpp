@@ -1,18 +1,38 @@
 #include <iostream>
 #include <map>
-#include <unordered_set>
+#include <unordered_map>
+#include <algorithm>
+#include <string>
 #include <fstream>
+#include <sstream>
 #include <cassert>
 #include <ctime>
 #include <thread>
-#include <stack>
 #include <mutex>
-#include <array>
 #include <vector>
 #include <chrono>
+#include <atomic>
 #include <getopt.h>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "gzstream/gzstream.h"
 #include "kmer/kmer.h"
+#include "kmer/kmer_table.h"
+#include "kmer/bloom_filter.h"
+#include "kmer/mphf.h"
+#include "kmer/kmer_sampler.h"
+#include "thread/mpmc_queue.h"
+#include "thread/atomic_bitmap.h"
+#include "thread/atomic_rows.h"
+#include "thread/telemetry.h"
+#include "thread/arena.h"
+#include "io/gz_source.h"
+#include "io/fastq_chunk.h"
+#include "io/bgzf_writer.h"
 int Kmer::overlap = 0 ;
 Kmer Kmer::WORDFILTER ;
 void logtime() {
@@ -20,63 +40,801 @@ void logtime() {
     char* dt = ctime(&now);
     std::cerr<<dt<<std::endl;
 }
+// flush outputs and leave without destructors , the tables , caches and
+// arenas go with the process instead of one free per block .
+[[noreturn]] void fastExit(int code) {
+    std::cout.flush();
+    std::cerr.flush();
+    fflush(NULL);
+    _exit(code);
+}
+//
+// binary index file , built by "classify build-index" :
+//   IndexHeader | haplotype names ( '\n' terminated ) | padding | table slots
+// slots start at a page boundary and are used in place by mmap , so
+// concurrent classify jobs on one host share the page cache of the index.
+// slots are KmerHapTable slots ( INDEX_TABLE ) or the words of a
+// CompactHapTable ( INDEX_COMPACT ) .
+//
+#define INDEX_MAGIC "MSLRIDX"
+#define INDEX_VERSION 2
+#define INDEX_TABLE 0
+#define INDEX_COMPACT 1
+struct IndexHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t K;
+    uint32_t hap_num;
+    uint32_t slot_size;
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t shared;
+    uint64_t names_size;
+    uint64_t slots_offset;
+    uint32_t layout;
+    uint16_t shard_id;    // kmer shard of a sharded index
+    uint16_t shard_num;   // 0 or 1 : not sharded
+};
+
+// kmer lookup counts of one worker
+struct VoteStats {
+    uint64_t kmers ;      // kmers looked up
+    uint64_t rejected ;   // stopped by the prefilter
+    uint64_t hits ;       // owned by one haplotype
+    uint64_t skipped ;    // reads of decided barcodes , not looked up
+    uint64_t exact_kmers ;// kmers looked up by the exhaustive run of --sample-compare
+    uint64_t no_kmer ;    // reads without any kmer between N
+    VoteStats() : kmers(0) , rejected(0) , hits(0) , skipped(0) , exact_kmers(0) , no_kmer(0) {}
+    void Add(const VoteStats & o) {
+        kmers += o.kmers ; rejected += o.rejected ; hits += o.hits ; skipped += o.skipped ;
+        exact_kmers += o.exact_kmers ; no_kmer += o.no_kmer ;
+    }
+};
+
 //
-// load & cache maternal unique kmer & paternal unique kmer
+// load & cache haplotype unique kmers
+//   all haplotypes share one table : kmer -> haplotype index
+//   an optional bloom filter in front of the table stops most kmers that
+//   no haplotype owns before they touch the table .
 //
-std::vector<std::unordered_set<Kmer>> g_kmers;
+struct HapIndex {
+    HapIndex() : shard_id(0) , shard_num(1) {}
+    virtual ~HapIndex() {}
+    // Load keeps only kmers of hash shard shard_id in shard_num shards ,
+    // and only kmers kept by prune , see KmerSampling::MOD
+    int shard_id , shard_num ;
+    KmerSampling prune ;
+    bool InShard(uint64_t hash) const {
+        return ( shard_num <= 1 || mixHash64(hash) % shard_num == (uint64_t)shard_id )
+            && prune.Keep(hash) ;
+    }
+    // load files[i] as haplotype i by t_num threads , one kmer per line .
+    // @return : kmer number loaded of every file
+    virtual std::vector<long> Load(const std::vector<std::string> & files , int t_num) = 0 ;
+    virtual void EraseAdaptor(const std::string & seq) = 0 ;
+    // count kmers of read owned by each haplotype into vote
+    // only kmers chosen by sampling are looked up
+    // @return : kmers of read without N , 0 if read can not be classified
+    virtual long Vote(const char * read , int len , std::vector<int> & vote , VoteStats & stats ,
+            const KmerSampling & sampling) const = 0 ;
+    // build the prefilter from kmers owned by one haplotype
+    // @return : bytes of the filter
+    virtual size_t BuildFilter(double fpr , size_t bytes , int & hashes) = 0 ;
+    virtual size_t Shared() const = 0 ;
+    virtual size_t Size() const = 0 ;
+    // fill table fields of header , then write slots after it
+    virtual void FillHeader(IndexHeader & header) const = 0 ;
+    virtual void WriteSlots(std::ostream & ofs) const = 0 ;
+    // use slots of a mapped index file , read only
+    // @return : false if slots are not built by the same KmerHapIndex
+    virtual bool Attach(const char * slots , const IndexHeader & header) = 0 ;
+    // @return : a read only compact copy , NULL if this is compact already
+    virtual HapIndex * Compact(int fp_bits , int hap_num) const = 0 ;
+};
+
+//
+// read only index on a minimal perfect hash , see CompactHapTable .
+// kmers are keyed by their 64 bits hash , only fingerprints are kept .
+//
+template<int K>
+struct KmerCompactIndex : public HapIndex {
+    typedef KmerT<K> KmerType;
+    typedef CanonicalKmerIterator<KmerType> Iterator;
+    CompactHapTable table;
+    size_t shared ;
+    KmerCompactIndex() : shared(0) {}
+
+    std::vector<long> Load(const std::vector<std::string> & , int) { assert(false); return std::vector<long>() ; }
+    void EraseAdaptor(const std::string &) { assert(false); }
+    static const int BATCH = 16 ;
+    long Vote(const char * read , int len , std::vector<int> & vote , VoteStats & stats ,
+            const KmerSampling & sampling) const {
+        SampledKmerIterator<KmerType> it(read,len,sampling);
+        KmerType kmer ;
+        uint64_t keys[BATCH];
+        uint64_t index[BATCH];
+        bool more = true ;
+        while( more ) {
+            int n = 0 ;
+            while( n < BATCH && ( more = it.Next(kmer) ) ) {
+                keys[n] = std::hash<KmerType>()(kmer);
+                table.Prefetch(keys[n]);
+                n ++ ;
+            }
+            stats.kmers += n ;
+            for( int i = 0 ; i < n ; i ++ ) {
+                index[i] = table.Index(keys[i]);
+                table.PrefetchEntry(index[i]);
+            }
+            for( int i = 0 ; i < n ; i ++ ) {
+                int hap = table.FindAt(keys[i],index[i]);
+                if( hap >= 0 ) {
+                    vote[hap] ++ ;
+                    stats.hits ++ ;
+                }
+            }
+        }
+        return it.Walked() ;
+    }
+    // the compact table is small already
+    size_t BuildFilter(double , size_t , int & hashes) { hashes = 0 ; return 0 ; }
+    size_t Shared() const { return shared ; }
+    size_t Size() const { return table.Size() ; }
+    void FillHeader(IndexHeader & header) const {
+        header.layout = INDEX_COMPACT ;
+        header.slot_size = sizeof(uint64_t);
+        header.capacity = table.WordNum();
+        header.used = table.Size();
+        header.shared = shared ;
+    }
+    void WriteSlots(std::ostream & ofs) const {
+        ofs.write((const char *)table.Words() , table.WordNum() * sizeof(uint64_t));
+    }
+    bool Attach(const char * slots , const IndexHeader & header) {
+        if( header.layout != INDEX_COMPACT || header.slot_size != sizeof(uint64_t) ) return false ;
+        shared = header.shared ;
+        return table.Attach((const uint64_t *)slots , header.capacity);
+    }
+    HapIndex * Compact(int , int) const { return NULL ; }
+};
+
+// K is fixed at compile time , see KmerT .
+template<int K>
+struct KmerHapIndex : public HapIndex {
+    typedef KmerT<K> KmerType;
+    typedef KmerTUtil<KmerType> Util;
+    typedef CanonicalKmerIterator<KmerType> Iterator;
+    KmerHapTable<KmerType> table;
+    BlockedBloomFilter filter;
+
+    // files are cut into chunks of CHUNK_SIZE bytes , threads take chunks
+    // of any file and insert by PartitionedInserter .
+    static const size_t CHUNK_SIZE = 64 << 20 ;
+    typedef PartitionedInserter<KmerHapTable<KmerType> > Inserter;
+    std::vector<long> Load(const std::vector<std::string> & files , int t_num) {
+        std::vector<std::pair<int,size_t> > chunks;   // file , begin
+        std::vector<size_t> sizes(files.size(),0);
+        double expect = 0 ;
+        for( int f = 0 ; f < (int)files.size() ; f ++ ) {
+            struct stat st ;
+            if( stat(files[f].c_str(),&st) == 0 ) sizes[f] = st.st_size ;
+            for( size_t b = 0 ; b < sizes[f] ; b += CHUNK_SIZE )
+                chunks.push_back(std::make_pair(f,b));
+            expect += sizes[f] / ( K + 1 ) ;
+        }
+        // kmers kept by shard and prune , with some room for chance
+        if( shard_num > 1 ) expect = expect / shard_num * 1.1 ;
+        if( prune.mode == KmerSampling::MOD ) expect = expect / prune.step * 1.1 ;
+        Inserter inserter(table,(size_t)expect);
+        std::vector<long> totals(files.size(),0);
+        std::atomic<size_t> next(0);
+        std::mutex lock;
+        std::vector<std::thread> threads;
+        for( int t = 0 ; t < t_num ; t ++ ) {
+            threads.push_back(std::thread([&](){
+                typename Inserter::Batch batch(inserter);
+                std::vector<long> counts(files.size(),0);
+                std::string buffer;
+                for( size_t c ; ( c = next ++ ) < chunks.size() ; ) {
+                    int f = chunks[c].first ;
+                    counts[f] += LoadChunk(files[f],chunks[c].second,sizes[f],f,batch,buffer);
+                }
+                batch.Flush();
+                std::lock_guard<std::mutex> guard(lock);
+                for( size_t f = 0 ; f < files.size() ; f ++ ) totals[f] += counts[f];
+            }));
+        }
+        for( auto & t : threads ) t.join();
+        inserter.Finish();
+        return totals ;
+    }
+    // load lines starting in [begin,begin+CHUNK_SIZE) , a line without
+    // '\n' at file end is ignored .
+    long LoadChunk(const std::string & file , size_t begin , size_t size , int index ,
+            typename Inserter::Batch & batch , std::string & buffer){
+        size_t end = std::min(begin + CHUNK_SIZE , size);
+        size_t from = begin > 0 ? begin - 1 : 0 ;
+        std::ifstream ifs(file,std::ios::binary);
+        ifs.seekg(from);
+        buffer.resize(end - from);
+        ifs.read(&buffer[0],buffer.size());
+        buffer.resize(ifs.gcount());
+        if( end < size && ! buffer.empty() && buffer.back() != '\n' ) {
+            // the last line goes on into the next chunk
+            std::string tail;
+            std::getline(ifs,tail);
+            buffer += tail ;
+            if( ! ifs.eof() ) buffer += '\n' ;
+        }
+        const char * p = buffer.data() , * e = p + buffer.size() ;
+        if( begin > 0 ) {
+            // the line before begin belongs to the previous chunk
+            const char * nl = (const char *)memchr(p,'\n',e - p);
+            p = nl == NULL ? e : nl + 1 ;
+        }
+        long total_kmer = 0 ;
+        KmerType kmer;
+        for( const char * nl ; p < e && ( nl = (const char *)memchr(p,'\n',e - p) ) != NULL ; p = nl + 1 ) {
+            Iterator it(p,nl - p);
+            if( ! it.Next(kmer) ) continue ;
+            size_t hash = table.HashOf(kmer);
+            if( InShard(hash) ) {
+                batch.Add(kmer,hash,index);
+                total_kmer++;
+            }
+        }
+        return total_kmer ;
+    }
+    void EraseAdaptor(const std::string & seq) {
+        Iterator it(seq.data(),seq.size());
+        KmerType kmer;
+        while( it.Next(kmer) ){
+            int j = table.Erase(kmer);
+            if( j >= 0 )
+                std::cerr<<" INFO : erase adaptor kmer from hap "<<j<<" ; kmer="<<BaseStr::BaseStr2Str(Util::ToBaseStr(kmer))<<std::endl;
+        }
+    }
+    // kmers are looked up in windows of BATCH : hash and prefetch all ,
+    // then probe , the table is much larger than cache .
+    // with a filter : prefetch filter blocks , test , prefetch the table
+    // only for kmers passed , then probe .
+    static const int BATCH = 16 ;
+    long Vote(const char * read , int len , std::vector<int> & vote , VoteStats & stats ,
+            const KmerSampling & sampling) const {
+        SampledKmerIterator<KmerType> it(read,len,sampling);
+        KmerType kmers[BATCH];
+        size_t hashes[BATCH];
+        size_t buckets[BATCH];
+        bool use_filter = ! filter.Empty() ;
+        bool more = true ;
+        while( more ) {
+            int n = 0 ;
+            while( n < BATCH && ( more = it.Next(kmers[n]) ) ) {
+                hashes[n] = table.HashOf(kmers[n]);
+                if( use_filter ) {
+                    buckets[n] = filter.BlockOf(hashes[n]);
+                    filter.Prefetch(buckets[n]);
+                } else {
+                    buckets[n] = table.BucketOf(hashes[n]);
+                    table.Prefetch(buckets[n]);
+                }
+                n ++ ;
+            }
+            stats.kmers += n ;
+            if( use_filter ) {
+                int m = 0 ;
+                for( int i = 0 ; i < n ; i ++ ) {
+                    if( ! filter.Test(hashes[i],buckets[i]) ) continue ;
+                    kmers[m] = kmers[i];
+                    buckets[m] = table.BucketOf(hashes[i]);
+                    table.Prefetch(buckets[m]);
+                    m ++ ;
+                }
+                stats.rejected += n - m ;
+                n = m ;
+            }
+            for( int i = 0 ; i < n ; i ++ ) {
+                int hap = table.FindAt(kmers[i],buckets[i]);
+                if( hap >= 0 ) {
+                    vote[hap] ++ ;
+                    stats.hits ++ ;
+                }
+            }
+        }
+        return it.Walked() ;
+    }
+    size_t BuildFilter(double fpr , size_t bytes , int & hashes) {
+        typedef KmerHapTable<KmerType> Table;
+        size_t n = 0 ;
+        for( size_t i = 0 ; i < table.Capacity() ; i ++ )
+            if( table.slots[i].hap < Table::NOHAP ) n ++ ;
+        filter.Init(n,fpr,bytes);
+        for( size_t i = 0 ; i < table.Capacity() ; i ++ )
+            if( table.slots[i].hap < Table::NOHAP )
+                filter.Insert(table.HashOf(table.slots[i].key));
+        hashes = filter.Hashes();
+        return filter.Bytes();
+    }
+    size_t Shared() const { return table.Shared() ; }
+    size_t Size() const { return table.Size() ; }
+    void FillHeader(IndexHeader & header) const {
+        header.layout = INDEX_TABLE ;
+        header.slot_size = sizeof(typename KmerHapTable<KmerType>::Slot);
+        header.capacity = table.Capacity();
+        header.used = table.Size();
+        header.shared = table.Shared();
+    }
+    void WriteSlots(std::ostream & ofs) const {
+        ofs.write((const char *)table.slots , table.Capacity() * sizeof(typename KmerHapTable<KmerType>::Slot));
+    }
+    bool Attach(const char * slots , const IndexHeader & header) {
+        typedef typename KmerHapTable<KmerType>::Slot Slot;
+        if( header.layout != INDEX_TABLE || header.slot_size != sizeof(Slot) ) return false ;
+        table.Attach((const Slot *)slots,header.capacity,header.used,header.shared);
+        return true ;
+    }
+    // kmers whose 64 bits hash collide are dropped as shared ones.
+    HapIndex * Compact(int fp_bits , int hap_num) const {
+        typedef KmerHapTable<KmerType> Table;
+        std::vector<std::pair<uint64_t,uint16_t> > entries;
+        entries.reserve(table.Size());
+        for( size_t i = 0 ; i < table.Capacity() ; i ++ )
+            if( table.slots[i].hap < Table::NOHAP )
+                entries.push_back(std::make_pair(table.HashOf(table.slots[i].key),table.slots[i].hap));
+        std::sort(entries.begin(),entries.end());
+        size_t n = 0 , dropped = 0 ;
+        for( size_t i = 0 ; i < entries.size() ; ) {
+            size_t j = i + 1 ;
+            while( j < entries.size() && entries[j].first == entries[i].first ) j ++ ;
+            if( j == i + 1 ) entries[n++] = entries[i];
+            else dropped += j - i ;
+            i = j ;
+        }
+        entries.resize(n);
+        KmerCompactIndex<K> * index = new KmerCompactIndex<K>();
+        index->table.Build(entries,fp_bits,hap_num);
+        index->shared = table.Size() - n ;
+        if( dropped > 0 )
+            std::cerr<<" INFO : drop "<<dropped<<" kmers with colliding 64 bits hash"<<std::endl;
+        return index ;
+    }
+};
+
+// instantiate T<K> for every K in [MIN_K,MAX] , create the one equal to k.
+#define MIN_K 11
+#define MAX_K 64
+template<template<int> class T , class Base , int MAX>
+struct KDispatch {
+    static Base * Create(int k) {
+        if( k == MAX ) return new T<MAX>();
+        return KDispatch<T,Base,MAX-1>::Create(k);
+    }
+};
+template<template<int> class T , class Base>
+struct KDispatch<T,Base,MIN_K-1> {
+    static Base * Create(int) { return NULL; }
+};
+HapIndex * CreateHapIndex(int k) { return KDispatch<KmerHapIndex,HapIndex,MAX_K>::Create(k); }
+HapIndex * CreateCompactIndex(int k) { return KDispatch<KmerCompactIndex,HapIndex,MAX_K>::Create(k); }
+
+HapIndex * g_kmers = NULL;
+int g_hap_num=0;
 int g_K=0;
-void load_kmers(const std::string & file,int index){
-    assert( g_kmers.size() == index );
-    g_kmers.push_back(std::unordered_set<Kmer>());
-    std::ifstream ifs(file);
+// a node of a multi-node run handles one kmer shard and/or one read shard
+int g_kmer_shard=0 , g_kmer_shards=1;
+int g_read_shard=0 , g_read_shards=1;
+// early decision : a barcode is decided once its leading haplotype is ahead
+// of the second by margin votes and by ratio times , see EarlyDecision .
+int g_early_margin=0;
+double g_early_ratio=0;
+// kmers looked up per read , see KmerSampling .
+// with g_sample_compare every read is also voted exhaustively into another
+// cache , to report how calls change .
+KmerSampling g_sampling;
+bool g_sample_compare = false;
+// telemetry : seconds between progress lines ( 0 for none ) , wall time of
+// stages , counters of the read pass , see printTelemetry .
+double g_progress = 10 ;
+StageTimes g_stages;
+
+// parse "i/n"
+// @return : false if it is not 0 <= i < n
+bool parseShard(const char * str , int & i , int & n){
+    return sscanf(str,"%d/%d",&i,&n) == 2 && i >= 0 && i < n ;
+}
+// load files[i] as haplotype i by t_num threads ,
+// the first line of files[0] sets g_K .
+void load_kmers(const std::vector<std::string> & files , int t_num){
+    assert( g_hap_num == 0 );
+    assert( files.size() <= (size_t)KmerHapTable<Kmer>::MAX_HAP + 1 );
+    for( int i = 0 ; i < (int)files.size() ; i++ )
+        std::cerr<<"__load hap "<<i<<" kmers from file "<<files[i]<<std::endl;
+    g_hap_num = files.size() ;
+    std::ifstream ifs(files[0]);
     std::string line;
-    int total_kmer = 0 ;
-    if(index==0){
-        std::getline(ifs,line);
-        g_K = line.size();
-        Kmer::InitFilter(g_K);
-        g_kmers[index].insert(Kmer::str2Kmer(BaseStr::str2BaseStr(line)));
-        total_kmer++;
+    std::getline(ifs,line);
+    g_K = line.size();
+    g_kmers = CreateHapIndex(g_K);
+    if( g_kmers == NULL ) {
+        std::cerr<<"ERROR : kmer size "<<g_K<<" is not in ["<<MIN_K<<","<<MAX_K<<"] , exit ..."<<std::endl;
+        exit(1);
+    }
+    g_kmers->shard_id = g_kmer_shard ;
+    g_kmers->shard_num = g_kmer_shards ;
+    if( g_sampling.mode == KmerSampling::MOD && ! g_sample_compare )
+        g_kmers->prune = g_sampling ;
+    std::vector<long> totals = g_kmers->Load(files,t_num);
+    for( int i = 0 ; i < (int)files.size() ; i++ )
+        std::cerr<<"Recorded "<<totals[i]<<" haplotype "<<i<<" specific "<<g_K<<"-mers\n";
+}
+
+void save_index(const std::string & file , const std::vector<std::string> & haps){
+    IndexHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION ;
+    header.K = g_K ;
+    header.hap_num = g_hap_num ;
+    std::string names ;
+    for( const auto & hap : haps ) names += hap + '\n' ;
+    header.names_size = names.size() ;
+    long page = sysconf(_SC_PAGESIZE);
+    header.slots_offset = ( sizeof(header) + names.size() + page - 1 ) / page * page ;
+    g_kmers->FillHeader(header);
+    header.shard_id = g_kmer_shard ;
+    header.shard_num = g_kmer_shards ;
+    std::ofstream ofs(file,std::ios::binary);
+    ofs.write((const char *)&header,sizeof(header));
+    ofs.write(names.data(),names.size());
+    std::string padding(header.slots_offset - sizeof(header) - names.size(),'\0');
+    ofs.write(padding.data(),padding.size());
+    g_kmers->WriteSlots(ofs);
+    ofs.close();
+    if( ! ofs ) {
+        std::cerr<<"ERROR : failed to write index file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::cerr<<"Saved "<<g_kmers->Size()<<" "<<g_K<<"-mers of "<<g_hap_num<<" haplotypes into "<<file<<std::endl;
+}
+
+// replace g_kmers by its read only compact copy
+void compact_index(int fp_bits){
+    HapIndex * compact = g_kmers->Compact(fp_bits,g_hap_num);
+    if( compact == NULL ) return ;
+    delete g_kmers ;
+    g_kmers = compact ;
+    IndexHeader header;
+    g_kmers->FillHeader(header);
+    std::cerr<<"Compacted "<<g_kmers->Size()<<" "<<g_K<<"-mers into "
+        <<header.capacity * header.slot_size<<" bytes with "<<fp_bits<<" bits fingerprints"<<std::endl;
+}
+
+// the mapping is kept until exit.
+void map_index(const std::string & file , std::vector<std::string> & haps){
+    int fd = open(file.c_str(),O_RDONLY);
+    struct stat st;
+    if( fd < 0 || fstat(fd,&st) != 0 || st.st_size < (off_t)sizeof(IndexHeader) ) {
+        std::cerr<<"ERROR : failed to open index file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
     }
-    while(!std::getline(ifs,line).eof()){
-        g_kmers[index].insert(Kmer::str2Kmer(BaseStr::str2BaseStr(line)));
-        total_kmer++;
+    void * addr = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if( addr == MAP_FAILED ) {
+        std::cerr<<"ERROR : failed to mmap index file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
     }
-    std::cerr<<"Recorded "<<total_kmer<<" haplotype "<<index<<" specific "<<g_K<<"-mers\n"; 
+    madvise(addr,st.st_size,MADV_WILLNEED);
+    const char * data = (const char *)addr;
+    IndexHeader header;
+    memcpy(&header,data,sizeof(header));
+    if( memcmp(header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC)) == 0
+            && header.version != INDEX_VERSION ) {
+        std::cerr<<"ERROR : \""<<file<<"\" was built by another version of classify , please rebuild it , exit ..."<<std::endl;
+        exit(1);
+    }
+    if( memcmp(header.magic,INDEX_MAGIC,sizeof(INDEX_MAGIC)) != 0
+            || header.slots_offset + header.capacity * header.slot_size > (uint64_t)st.st_size ) {
+        std::cerr<<"ERROR : \""<<file<<"\" is not a valid index file , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::string names(data + sizeof(header) , header.names_size);
+    for( size_t s = 0 , e ; ( e = names.find('\n',s) ) != std::string::npos ; s = e + 1 )
+        haps.push_back(names.substr(s,e-s));
+    if( haps.size() != header.hap_num ) {
+        std::cerr<<"ERROR : haplotype number of \""<<file<<"\" does not match its names , exit ..."<<std::endl;
+        exit(1);
+    }
+    g_K = header.K ;
+    g_hap_num = header.hap_num ;
+    if( header.shard_num > 1 ) {
+        g_kmer_shard = header.shard_id ;
+        g_kmer_shards = header.shard_num ;
+    }
+    g_kmers = header.layout == INDEX_COMPACT ? CreateCompactIndex(g_K) : CreateHapIndex(g_K);
+    if( g_kmers == NULL || ! g_kmers->Attach(data + header.slots_offset , header) ) {
+        std::cerr<<"ERROR : \""<<file<<"\" was built by an incompatible classify , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::cerr<<"Mapped "<<header.used<<" "<<g_K<<"-mers of "<<g_hap_num<<" haplotypes from "<<file;
+    if( g_kmer_shards > 1 )
+        std::cerr<<" , kmer shard "<<g_kmer_shard<<"/"<<g_kmer_shards ;
+    std::cerr<<std::endl;
 }
 //
 // barcode haplotype relate functions
 //
+// barcode id :
+//   a stLFR barcode like 203_1533_1069 is three numbers in [0,1536] ,
+//   it is packed into 32 bits as a 1537-radix number without any allocation .
+//   other barcodes are interned into ids after all packed ids.
+typedef uint32_t barcode_t;
+#define BARCODE_RADIX 1537u
+#define PACKED_BARCODE_NUM ( BARCODE_RADIX * BARCODE_RADIX * BARCODE_RADIX )
+#define NO_BARCODE 0xFFFFFFFFu
+
+// interned names live in an arena , the table keeps name indexes only , so
+// interning costs no heap call per barcode and a lookup copies nothing.
+struct BarcodeDict {
+    std::mutex lock;
+    Arena arena;
+    std::vector<Span> names;        // id - PACKED_BARCODE_NUM -> name
+    std::vector<uint32_t> table;    // open addressing : names index + 1 , 0 is empty
+    const uint64_t generation ;     // one per dict ever made , see Intern
+    BarcodeDict() : table(1024,0) , generation(NextGeneration()) {}
+
+    static uint64_t NextGeneration(){
+        static std::atomic<uint64_t> next(1);
+        return next ++ ;
+    }
+
+    static uint64_t hashOf(const char * str , int len){
+        uint64_t h = 0xCBF29CE484222325ULL ;
+        for( int i = 0 ; i < len ; i ++ ) h = ( h ^ (uint8_t)str[i] ) * 0x100000001B3ULL ;
+        return mixHash64(h);
+    }
+    size_t locate(const char * str , int len) const {
+        size_t mask = table.size() - 1 ;
+        size_t i = hashOf(str,len) & mask ;
+        while( table[i] != 0 ) {
+            const Span & name = names[table[i]-1];
+            if( name.len == len && memcmp(name.data,str,len) == 0 ) break;
+            i = ( i + 1 ) & mask ;
+        }
+        return i ;
+    }
+    barcode_t Intern(const char * str , int len){
+        // reads of one barcode mostly come together , the last id of this
+        // thread is checked without the lock , it is only valid for the
+        // dict that gave it . a dict made again at the same address has
+        // another generation
+        thread_local uint64_t last_generation = 0 ;
+        thread_local barcode_t last_id = NO_BARCODE ;
+        thread_local std::string last_name ;
+        if( last_generation == generation && (int)last_name.size() == len
+                && memcmp(last_name.data(),str,len) == 0 )
+            return last_id ;
+        std::lock_guard<std::mutex> guard(lock);
+        size_t i = locate(str,len);
+        if( table[i] == 0 ) {
+            if( ( names.size() + 1 ) * 10 > table.size() * 7 ) {
+                rehash(table.size() * 2);
+                i = locate(str,len);
+            }
+            Span name ;
+            name.data = arena.Copy(str,len);
+            name.len = len ;
+            names.push_back(name);
+            table[i] = names.size() ;
+            assert( PACKED_BARCODE_NUM + names.size() < NO_BARCODE );
+        }
+        last_generation = generation ;
+        last_id = PACKED_BARCODE_NUM + table[i] - 1 ;
+        last_name.assign(str,len);
+        return last_id ;
+    }
+    std::string Name(barcode_t id) {
+        std::lock_guard<std::mutex> guard(lock);
+        const Span & name = names.at(id - PACKED_BARCODE_NUM);
+        return std::string(name.data,name.len);
+    }
+    private:
+        void rehash(size_t cap){
+            table.assign(cap,0);
+            for( size_t n = 0 ; n < names.size() ; n ++ )
+                table[locate(names[n].data,names[n].len)] = n + 1 ;
+        }
+} g_barcode_dict;
+
+// @return : false if str is not 3 numbers in [0,1536] joined by '_'
+bool packBarcode(const char * str , int len , barcode_t & id){
+    int field = 0 , digits = 0 ;
+    uint32_t value = 0 , packed = 0 ;
+    for( int i = 0 ; i <= len ; i ++ ) {
+        if( i == len || str[i] == '_' ) {
+            if( digits == 0 || value >= BARCODE_RADIX || ++field > 3 ) return false ;
+            packed = packed * BARCODE_RADIX + value ;
+            value = 0 ; digits = 0 ;
+        } else if ( str[i] >= '0' && str[i] <= '9' ) {
+            // leading zero can not round trip
+            if( digits == 1 && value == 0 ) return false ;
+            if( ++digits > 4 ) return false ;
+            value = value * 10 + ( str[i] - '0' );
+        } else
+            return false ;
+    }
+    if( field != 3 ) return false ;
+    id = packed ;
+    return true ;
+}
+
+barcode_t barcodeId(const char * str , int len){
+    barcode_t id ;
+    if( packBarcode(str,len,id) ) return id ;
+    return g_barcode_dict.Intern(str,len);
+}
+
+std::string barcodeName(barcode_t id){
+    if( id >= PACKED_BARCODE_NUM ) return g_barcode_dict.Name(id);
+    uint32_t c = id % BARCODE_RADIX ; id /= BARCODE_RADIX ;
+    uint32_t b = id % BARCODE_RADIX ; id /= BARCODE_RADIX ;
+    return std::to_string(id) + '_' + std::to_string(b) + '_' + std::to_string(c);
+}
+
+//
+// per barcode haplotype counts .
+//   every barcode has one row of g_hap_num+1 counts ,
+//   column 0 is hap -1 and column i+1 is hap i .
+//   rows are cut from blocks of BLOCK_ROWS rows , a block never moves nor
+//   grows , so rows are never copied and all blocks go at once .
+//   barcode -> row is an open addressing table .
+//
 struct BarcodeCache {
-    std::map<std::string, std::map<int,int>> barcode_haps;
-    void IncrBarcodeHaps(const std::string & barcode , int hap,int incr=1){
-        if( barcode_haps[barcode].find(hap) ==  barcode_haps[barcode].end() )
-            barcode_haps[barcode][hap] = 0 ;
-        barcode_haps[barcode][hap] +=incr ;
+    static const int BLOCK_BITS = 12 ;
+    static const size_t BLOCK_ROWS = 1 << BLOCK_BITS ;
+    int cols ;
+    std::vector<barcode_t> barcodes;  // row -> barcode
+    std::vector<std::vector<uint32_t> > blocks;  // BLOCK_ROWS * cols each
+    std::vector<barcode_t> keys;      // table : barcode
+    std::vector<uint32_t>  rows;      // table : row of barcode
+    size_t mask;
+
+    BarcodeCache() : cols(g_hap_num+1) , mask(1023) {
+        keys.assign(mask+1,NO_BARCODE);
+        rows.assign(mask+1,0);
+    }
+    size_t Size() const { return barcodes.size() ; }
+    const uint32_t * Counts(size_t row) const {
+        return blocks[row >> BLOCK_BITS].data() + ( row & ( BLOCK_ROWS - 1 ) ) * cols ;
+    }
+    // @return : row of barcode , -1 if barcode is not recorded
+    long Find(barcode_t barcode) const {
+        size_t i = Locate(barcode);
+        if( keys[i] == NO_BARCODE ) return -1 ;
+        return rows[i] ;
+    }
+
+    // find or create the row of barcode
+    uint32_t * Row(barcode_t barcode){
+        size_t i = Locate(barcode);
+        if( keys[i] == NO_BARCODE ) {
+            if( ( barcodes.size() + 1 ) * 10 > keys.size() * 7 ) {
+                Rehash(keys.size() * 2);
+                i = Locate(barcode);
+            }
+            keys[i] = barcode ;
+            rows[i] = barcodes.size() ;
+            if( ( barcodes.size() & ( BLOCK_ROWS - 1 ) ) == 0 )
+                blocks.push_back(std::vector<uint32_t>(BLOCK_ROWS * cols , 0));
+            barcodes.push_back(barcode);
+        }
+        return (uint32_t *)Counts(rows[i]);
+    }
+    void IncrBarcodeHaps(barcode_t barcode , int hap,int incr=1){
+        Row(barcode)[hap+1] += incr ;
+    }
+    // other is left empty
+    void Add(BarcodeCache && other){
+        if( Size() == 0 ) std::swap(*this,other);
+        else Add((const BarcodeCache &)other);
     }
     void Add(const BarcodeCache & other){
-        for(const auto & pair : other.barcode_haps ) {
-            for( const auto & pair1 : pair.second ){
-                IncrBarcodeHaps(pair.first,pair1.first,pair1.second);
+        assert( cols == other.cols );
+        if( Size() == 0 ) {
+            *this = other ;
+            return ;
+        }
+        for( size_t r = 0 ; r < other.Size() ; r ++ ) {
+            uint32_t * row = Row(other.barcodes[r]);
+            const uint32_t * add = other.Counts(r);
+            for( int c = 0 ; c < cols ; c ++ )
+                row[c] += add[c];
+        }
+    }
+
+    private:
+        size_t Locate(barcode_t barcode) const {
+            size_t i = mixHash64(barcode) & mask ;
+            while( keys[i] != NO_BARCODE && keys[i] != barcode )
+                i = ( i + 1 ) & mask ;
+            return i ;
+        }
+        void Rehash(size_t cap){
+            keys.assign(cap,NO_BARCODE);
+            rows.assign(cap,0);
+            mask = cap - 1 ;
+            for( size_t r = 0 ; r < barcodes.size() ; r ++ ) {
+                size_t i = Locate(barcodes[r]);
+                keys[i] = barcodes[r];
+                rows[i] = r ;
             }
         }
+};
+
+//
+// early decision , shared by all workers :
+//   while it is on , workers count into one lock free table of rows instead
+//   of their own caches , so a barcode is decided on the votes of all
+//   workers and no row is kept twice .
+//   decided barcodes are set in a bitmap tested without lock , their later
+//   reads are not looked up and not counted in any column .
+//
+struct EarlyDecision {
+    AtomicRows rows;
+    AtomicBitmap decided;
+    EarlyDecision() : rows(g_hap_num+1,NO_BARCODE) , decided(1ULL<<32) {}
+
+    bool Decided(barcode_t barcode) const { return decided.Test(barcode) ; }
+    // the same as BarcodeCache::IncrBarcodeHaps
+    void Incr(barcode_t barcode , int hap , uint32_t incr = 1){
+        rows.Row(barcode,mixHash64(barcode))[hap+1].fetch_add(incr,std::memory_order_relaxed);
+    }
+    // the same as MultiThread::addVotes , then decide barcode on its sums
+    void Add(barcode_t barcode , const std::vector<int> & vote){
+        std::atomic<uint32_t> * row = rows.Row(barcode,mixHash64(barcode));
+        bool found = false ;
+        uint32_t lead = 0 , second = 0 ;
+        for( int i = 0 ; i < g_hap_num ; i ++ ) {
+            uint32_t count = vote[i] > 0
+                ? row[i+1].fetch_add(vote[i],std::memory_order_relaxed) + vote[i]
+                : row[i+1].load(std::memory_order_relaxed) ;
+            found |= vote[i] > 0 ;
+            if( count > lead ) { second = lead ; lead = count ; }
+            else second = std::max(second,count);
+        }
+        if( ! found ) {
+            if( g_kmer_shard == 0 ) row[0].fetch_add(1,std::memory_order_relaxed);
+            return ;
+        }
+        if( lead - second >= (uint32_t)g_early_margin && lead >= g_early_ratio * second )
+            decided.Set(barcode);
+    }
+    size_t Size() const { return rows.Size() ; }
+    // add all rows into data , call it when no worker is running
+    void Collect(BarcodeCache & data) const {
+        rows.ForEach([&data](uint32_t barcode , const std::atomic<uint32_t> * counts){
+            uint32_t * row = data.Row(barcode);
+            for( int c = 0 ; c < data.cols ; c ++ )
+                row[c] += counts[c].load(std::memory_order_relaxed);
+        });
     }
 };
+EarlyDecision * g_early = NULL;
 
-int getHap(const std::string & barcode , const std::map<int,int> & data){
+// data : counts of barcode , column 0 is hap -1
+int getHap(const std::string & barcode , const uint32_t * data){
     if( barcode == "0_0_0" || barcode == "0_0" || barcode == "0" )
         return -1;
-    int first = 0 , second = 0 , first_index = -1;
-    for( int i = 0 ; i< (int)g_kmers.size() ; i++ ){
-        if( data.find(i) == data.end() ) 
-            continue;
-        else if( data.at(i) > first ) {
+    uint32_t first = 0 , second = 0 ;
+    int first_index = -1;
+    for( int i = 0 ; i< g_hap_num ; i++ ){
+        uint32_t count = data[i+1];
+        if( count > first ) {
             second = first ;
-            first = data.at(i);
+            first = count;
             first_index = i ;
         }
-        else if( data.at(i) > second ){
-            second = data.at(i);
+        else if( count > second ){
+            second = count;
         }
     }
     if( first > 0 && first_index != -1 && first > second )
@@ -85,11 +843,6 @@ int getHap(const std::string & barcode , const std::map<int,int> & data){
         return -1 ;
 }
 
-int getHapCount(const std::map<int,int> & data , int hap){
-    if ( data.find(hap) != data.end() ) return data.at(hap);
-    return 0 ;
-}
-
 std::string getSpeciesName(const std::string & file){
     int start  = 0 ;
     for( int i = 0 ; i < (int)file.size() ; i ++){
@@ -102,21 +855,130 @@ std::string getSpeciesName(const std::string & file){
 void printBarcodeInfos(const BarcodeCache& g_barcode_haps , 
         const std::vector<std::string> & haps){
     std::cout<<"barcode_str\thap_result";
-    for( int i = 0 ; i < (int)g_kmers.size() ; i ++ ){
+    for( int i = 0 ; i < g_hap_num ; i ++ ){
         std::cout<<'\t'<<getSpeciesName(haps.at(i));
     }
     std::cout<<'\n';
-    for(const auto & pair : g_barcode_haps.barcode_haps){
+    // print in barcode string order
+    std::vector<std::pair<std::string,size_t>> order;
+    order.reserve(g_barcode_haps.Size());
+    for( size_t r = 0 ; r < g_barcode_haps.Size() ; r ++ )
+        order.push_back(std::make_pair(barcodeName(g_barcode_haps.barcodes[r]),r));
+    std::sort(order.begin(),order.end());
+    for(const auto & pair : order){
         std::cout<<pair.first;
-        const auto & data=pair.second;
+        const uint32_t * data = g_barcode_haps.Counts(pair.second);
         std::cout<<'\t'<<getHap(pair.first,data);
-        for( int i = 0 ; i < (int)g_kmers.size() ; i ++ )
-            std::cout<<'\t'<<getHapCount(data,i);
+        for( int i = 0 ; i < g_hap_num ; i ++ )
+            std::cout<<'\t'<<data[i+1];
         std::cout<<'\n';
-        //std::cout<<'\t'<<getHapCount(data,-1)<<'\n';
+        //std::cout<<'\t'<<data[0]<<'\n';
     }
 }
 
+//
+// binary partial result of one shard , merged by "classify merge" :
+//   PartialHeader | haplotype names ( '\n' terminated ) | rows
+//   row : barcode id , ( length , name ) if id is not packed , cols counts
+// interned barcode ids are local to a process , so their names are saved.
+//
+#define PARTIAL_MAGIC "MSLRBCP"
+#define PARTIAL_VERSION 1
+struct PartialHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t hap_num;
+    uint64_t names_size;
+    uint64_t rows;
+};
+
+void save_partial(const std::string & file , const BarcodeCache & data ,
+        const std::vector<std::string> & haps){
+    PartialHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,PARTIAL_MAGIC,sizeof(PARTIAL_MAGIC));
+    header.version = PARTIAL_VERSION ;
+    header.hap_num = g_hap_num ;
+    std::string names ;
+    for( const auto & hap : haps ) names += hap + '\n' ;
+    header.names_size = names.size() ;
+    header.rows = data.Size() ;
+    std::ofstream ofs(file,std::ios::binary);
+    ofs.write((const char *)&header,sizeof(header));
+    ofs.write(names.data(),names.size());
+    for( size_t r = 0 ; r < data.Size() ; r ++ ) {
+        barcode_t id = data.barcodes[r];
+        ofs.write((const char *)&id,sizeof(id));
+        if( id >= PACKED_BARCODE_NUM ) {
+            std::string name = barcodeName(id);
+            uint32_t len = name.size();
+            ofs.write((const char *)&len,sizeof(len));
+            ofs.write(name.data(),len);
+        }
+        ofs.write((const char *)data.Counts(r),data.cols * sizeof(uint32_t));
+    }
+    ofs.close();
+    if( ! ofs ) {
+        std::cerr<<"ERROR : failed to write partial file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::cerr<<"Saved "<<data.Size()<<" barcodes into "<<file<<std::endl;
+}
+
+// add counts of a partial file into data ,
+// the first file sets g_hap_num and haps , others must have the same haps.
+void load_partial(const std::string & file , BarcodeCache * & data ,
+        std::vector<std::string> & haps){
+    std::ifstream ifs(file,std::ios::binary);
+    PartialHeader header;
+    if( ! ifs.read((char *)&header,sizeof(header))
+            || memcmp(header.magic,PARTIAL_MAGIC,sizeof(PARTIAL_MAGIC)) != 0
+            || header.version != PARTIAL_VERSION ) {
+        std::cerr<<"ERROR : \""<<file<<"\" is not a valid partial file , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::string names(header.names_size,'\0');
+    ifs.read(&names[0],names.size());
+    std::vector<std::string> file_haps;
+    for( size_t s = 0 , e ; ( e = names.find('\n',s) ) != std::string::npos ; s = e + 1 )
+        file_haps.push_back(names.substr(s,e-s));
+    // rows have hap_num+1 counts
+    if( ! ifs || header.hap_num != file_haps.size() ) {
+        std::cerr<<"ERROR : haplotype number of \""<<file<<"\" does not match its names , exit ..."<<std::endl;
+        exit(1);
+    }
+    if( data == NULL ) {
+        g_hap_num = header.hap_num ;
+        haps = file_haps ;
+        data = new BarcodeCache();
+    } else if ( file_haps != haps ) {
+        std::cerr<<"ERROR : haplotypes of \""<<file<<"\" differ from the first partial file , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::vector<uint32_t> counts(data->cols);
+    std::string name ;
+    for( uint64_t r = 0 ; r < header.rows ; r ++ ) {
+        barcode_t id ;
+        ifs.read((char *)&id,sizeof(id));
+        if( id >= PACKED_BARCODE_NUM ) {
+            uint32_t len = 0 ;
+            ifs.read((char *)&len,sizeof(len));
+            name.resize(len);
+            ifs.read(&name[0],len);
+            id = barcodeId(name.data(),len);
+        }
+        ifs.read((char *)counts.data(),counts.size() * sizeof(uint32_t));
+        uint32_t * row = data->Row(id);
+        for( int c = 0 ; c < data->cols ; c ++ )
+            row[c] += counts[c];
+    }
+    if( ! ifs ) {
+        std::cerr<<"ERROR : \""<<file<<"\" is truncated , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::cerr<<"Merged "<<header.rows<<" barcodes from "<<file<<std::endl;
+}
+
 //
 //reads relate functions
 //
@@ -134,203 +996,1202 @@ std::string parseName(const std::string & head){
     return head.substr(s+1,e-s-1);
 }
 
-#define max_buffer 1024
+// same as parseName , but the barcode is left in head.
+Span barcodeSpan(const char * head , int len){
+    int s=-1, e=-1;
+    for( int i = 0 ; i< len; i++ ){
+        if( head[i] == '#' ) s=i;
+        if( head[i] == '/' ) e=i;
+    }
+    if( e < s + 1 ) e = len ;
+    Span barcode = { head+s+1 , e-s-1 };
+    return barcode ;
+}
+
+// same as parseName , but return barcode id without allocation.
+barcode_t parseBarcode(const char * head , int len){
+    Span barcode = barcodeSpan(head,len);
+    return barcodeId(barcode.data,barcode.len);
+}
+
+// a block of whole fastq records , see FastqChunkReader
+//   SINGLE      : every record is one work item
+//   PAIRED      : mate.records[i] is the mate of chunk.records[i]
+//   INTERLEAVED : chunk.records[2i+1] is the mate of chunk.records[2i]
 struct Buffer{
-    std::array<std::string,max_buffer> heads;
-    std::array<std::string,max_buffer> seqs ;
-    void Init() { size = 0 ; }
-    int size ;
+    enum Layout { SINGLE = 0 , PAIRED , INTERLEAVED };
+    FastqChunk chunk;
+    FastqChunk mate;
+    Layout layout;
+    void Init() { chunk.num = 0 ; mate.num = 0 ; layout = SINGLE ; }
+    // records of chunk per work item
+    int Step() const { return layout == INTERLEAVED ? 2 : 1 ; }
+    // @return : mate of chunk.records[i] , NULL if not paired
+    const FastqRecord * Mate(int i) const {
+        if( layout == PAIRED ) return &mate.records[i] ;
+        if( layout == INTERLEAVED ) return &chunk.records[i+1] ;
+        return NULL ;
+    }
 };
 
+//
+// worker pool :
+//   the producer takes an empty Buffer from pool ( blocks if all buffers are
+//   in flight , which is the backpressure ) , fills it and submit it to jobs.
+//   workers pop jobs in FIFO order and give buffers back to pool after use.
+//   only Buffer pointers move between threads , reads are never copied.
+// one pool lives for the whole run and may be fed by several producers ,
+// each worker counts into its own cache , caches are merged once at end.
+//
 struct MultiThread {
     int t_nums ;
-    bool end;
-    bool busy;
     void Worker(int index){
-        std::pair<std::string,std::string> job;
-        Buffer buffer;
-        while(true){
-            locks[index].lock();
-            if( caches[index].empty() ){
-                busy = false ;
-                locks[index].unlock();
-                if(end) return ;
-                std::this_thread::sleep_for(std::chrono::microseconds(10));
-                continue;
+        Buffer * buffer ;
+        VoteStats stats ;
+        ThreadCounters & counters = worker_counters[index];
+        uint64_t idle = nowNs() , busy ;
+        while( jobs.Pop(buffer) ){
+            busy = nowNs();
+            counters.Add(ThreadCounters::IDLE_NS,busy-idle);
+            uint64_t bases = 0 , bytes = 0 ;
+            for( int i = 0 ; i < buffer->chunk.num ; i += buffer->Step() ) {
+                const FastqRecord & record = buffer->chunk.records[i];
+                const FastqRecord * mate = buffer->Mate(i);
+                process_reads(record.head,record.seq,mate,index,stats);
+                bases += record.seq.len ;
+                bytes += record.raw.len ;
+                if( mate != NULL ) {
+                    bases += mate->seq.len ;
+                    bytes += mate->raw.len ;
+                }
             }
-            if( ! caches[index].empty() ){
-                //job=caches[index].top();
-                if( caches[index].size() > 300 ) busy = true ;
-                else if ( caches[index].size() < 50 ) busy = false ;
-                std::swap(buffer,caches[index].top());
-                caches[index].pop();
-                locks[index].unlock();
-                for( int i = 0 ; i < buffer.size ; i ++ )
-                    process_reads(buffer.heads.at(i),buffer.seqs.at(i),index);
-            } else 
-                locks[index].unlock();
-        }
-    }
-    MultiThread(int t_num){
+            counters.Add(ThreadCounters::READS,buffer->chunk.num+buffer->mate.num);
+            counters.Add(ThreadCounters::BASES,bases);
+            counters.Add(ThreadCounters::BYTES,bytes);
+            counters.Set(ThreadCounters::ROWS,barcode_caches[index].Size());
+            counters.Set(ThreadCounters::KMERS,stats.kmers);
+            counters.Set(ThreadCounters::HITS,stats.hits);
+            pool.Push(buffer);
+            idle = nowNs();
+            counters.Add(ThreadCounters::BUSY_NS,idle-busy);
+        }
+        counters.Add(ThreadCounters::IDLE_NS,nowNs()-idle);
+        vote_stats[index] = stats ;
+    }
+    // producers : threads that fill buffers , each gets some extra buffers.
+    MultiThread(int t_num , int producers = 1)
+        : jobs(t_num*4+producers*2) , pool(t_num*4+producers*2) {
         t_nums = t_num ;
+        p_nums = producers ;
+        worker_counters = new ThreadCounters[t_num];
+        producer_counters = new ThreadCounters[producers];
+        last_seconds = 0 ;
+        last[0] = last[1] = last[2] = 0 ;
         barcode_caches = new BarcodeCache[t_num];
-        locks = new std::mutex[t_num];
+        exact_caches = g_sample_compare ? new BarcodeCache[t_num] : NULL ;
+        votes.resize(t_num);
+        vote_stats.resize(t_num);
+        for(int i = 0 ; i < (int)pool.Capacity() ; i++){
+            Buffer * buffer = new Buffer();
+            buffers.push_back(buffer);
+            pool.Push(buffer);
+        }
         threads = new std::thread*[t_num];
-        busy = false;
-        end=false;
         for(int i = 0 ; i< t_num ; i++){
-            caches.push_back(std::stack<Buffer>());
             threads[i] = new std::thread([this,i](){int index=i ;Worker(index); });
         }
     }
     ~MultiThread(){
         delete [] threads;
-        delete [] locks;
         delete [] barcode_caches;
+        delete [] exact_caches;
+        delete [] worker_counters;
+        delete [] producer_counters;
+        for( Buffer * buffer : buffers ) delete buffer;
     }
-    bool containN(const std::string & read){
-        for( char c : read ) if ( c == 'N' ) return true ;
-        return false ; 
+    // the same barcode string goes to the same shard in every process ,
+    // it is hashed in the header , so reads of other shards are never interned
+    static int barcodeShard(const Span & name){
+        barcode_t id ;
+        uint64_t h = packBarcode(name.data,name.len,id) ? id : BarcodeDict::hashOf(name.data,name.len);
+        return mixHash64(h) % g_read_shards ;
     }
-    void process_reads(const std::string & head ,
-                         const std::string & read , int index) {
-        std::string barcode = parseName(head);
-        if( containN(read) ){
-            barcode_caches[index].IncrBarcodeHaps(barcode,-1,1);
+    // mate : the other read of a pair or NULL , a pair is voted as one read ,
+    // the producer has checked both have the same barcode .
+    void process_reads(const Span & head , const Span & read , const FastqRecord * mate ,
+                         int index , VoteStats & stats) {
+        Span name = barcodeSpan(head.data,head.len);
+        if( g_read_shards > 1 && barcodeShard(name) != g_read_shard )
+            return ;
+        barcode_t barcode = barcodeId(name.data,name.len);
+        if( g_early != NULL && g_early->Decided(barcode) ) {
+            // neither looked up nor counted , see EarlyDecision
+            stats.skipped ++ ;
             return ;
         }
-        std::vector<int> vote;
-        for( int i = 0 ; i< (int)g_kmers.size() ; i++ )
-            vote.push_back(0);
-        std::vector<Kmer> kmers=Kmer::chopRead2Kmer(BaseStr::str2BaseStr(read));
-        //for( int i = 0 ; i <(int)seq.size()-g_K+1;i++ ){
-        for(int i = 0 ; i <(int)kmers.size();i++){
-            const Kmer & kmer = kmers.at(i);
-            for( int j = 0 ; j< (int)g_kmers.size() ; j++ ) {
-                if( g_kmers[j].find(kmer) != g_kmers[j].end() )
-                    vote[j] ++ ;
+        std::vector<int> & vote = votes[index];
+        vote.assign(g_hap_num,0);
+        long kmers = g_kmers->Vote(read.data,read.len,vote,stats,g_sampling);
+        if( mate != NULL )
+            kmers += g_kmers->Vote(mate->seq.data,mate->seq.len,vote,stats,g_sampling);
+        if( kmers == 0 ){
+            // no kmer between N , count once over all kmer shards
+            stats.no_kmer ++ ;
+            if( g_kmer_shard == 0 && g_early != NULL )
+                g_early->Incr(barcode,-1);
+            else if( g_kmer_shard == 0 ) {
+                barcode_caches[index].IncrBarcodeHaps(barcode,-1,1);
+                if( exact_caches != NULL )
+                    exact_caches[index].IncrBarcodeHaps(barcode,-1,1);
             }
+            return ;
         }
+        if( g_early != NULL )
+            g_early->Add(barcode,vote);
+        else
+            addVotes(barcode_caches[index].Row(barcode),vote);
+        if( exact_caches != NULL ) {
+            VoteStats exact;
+            vote.assign(g_hap_num,0);
+            g_kmers->Vote(read.data,read.len,vote,exact,KmerSampling());
+            if( mate != NULL )
+                g_kmers->Vote(mate->seq.data,mate->seq.len,vote,exact,KmerSampling());
+            addVotes(exact_caches[index].Row(barcode),vote);
+            stats.exact_kmers += exact.kmers ;
+        }
+    }
+    // @return : false if no haplotype has vote
+    // a read without vote is counted by kmer shard 0 only , as a read
+    // without kmer , so merged shards count it once .
+    static bool addVotes(uint32_t * row , const std::vector<int> & vote){
         bool found = false;
-        for( int i = 0 ; i< (int)g_kmers.size() ; i++ ){
+        for( int i = 0 ; i< g_hap_num ; i++ ){
             if( vote[i] > 0 ) {
-                barcode_caches[index].IncrBarcodeHaps(barcode,i,vote[i]);
+                row[i+1] += vote[i];
                 found = true;
             }
         }
-        if ( ! found )
-            barcode_caches[index].IncrBarcodeHaps(barcode,-1);
+        if ( ! found && g_kmer_shard == 0 )
+            row[0] ++ ;
+        return found ;
     }
 
-    //void submit(const std::string & head ,const std::string & seq){
-    void submit(const Buffer & buffer ){
-        static long index = 0;
-        while( busy ) { std::this_thread::sleep_for(std::chrono::seconds(1));}
-        index ++ ;
-        int id = index % t_nums;
-        locks[id].lock();
-        caches[id].push(buffer);
-        locks[id].unlock();
+    // @return : an empty buffer , block until one is available.
+    // producer : index of the calling producer , for its counters .
+    Buffer * getBuffer(int producer = 0){
+        Buffer * buffer ;
+        uint64_t start = nowNs();
+        pool.Pop(buffer);
+        producer_counters[producer].Add(ThreadCounters::STALL_NS,nowNs()-start);
+        buffer->Init();
+        return buffer ;
+    }
+    void submit(Buffer * buffer , int producer = 0){
+        ThreadCounters & counters = producer_counters[producer];
+        size_t depth = jobs.Size();
+        counters.Add(ThreadCounters::CHUNKS,1);
+        counters.Add(ThreadCounters::DEPTH_SUM,depth);
+        counters.Max(ThreadCounters::DEPTH_MAX,depth);
+        uint64_t start = nowNs();
+        jobs.Push(buffer);
+        counters.Add(ThreadCounters::STALL_NS,nowNs()-start);
     }
+    // give back a buffer not used.
+    void putBuffer(Buffer * buffer){
+        pool.Push(buffer);
+    }
+    // no more submit , wait all jobs done.
     void wait(){
+        jobs.Close();
         for(int i = 0 ; i <t_nums; i++){
             threads[i]->join();
             delete threads[i];
         }
     }
-    void collectBarcodes(){
-        for(int i = 0 ; i<t_nums ;i++)
-            final_data.Add(barcode_caches[i]);
+    void collectBarcodes(BarcodeCache & data , VoteStats & stats , BarcodeCache * exact){
+        for(int i = 0 ; i<t_nums ;i++) {
+            data.Add(std::move(barcode_caches[i]));
+            stats.Add(vote_stats[i]);
+            if( exact != NULL ) exact->Add(std::move(exact_caches[i]));
+        }
+        if( g_early != NULL ) g_early->Collect(data);
+    }
+    // one line of progress , called by ProgressReporter
+    void progress(double seconds){
+        uint64_t reads = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::READS);
+        uint64_t bases = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::BASES);
+        uint64_t bytes = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::BYTES);
+        uint64_t kmers = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::KMERS);
+        uint64_t hits = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::HITS);
+        uint64_t busy = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::BUSY_NS);
+        uint64_t idle = ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::IDLE_NS);
+        uint64_t stall = ThreadCounters::Sum(producer_counters,p_nums,ThreadCounters::STALL_NS);
+        uint64_t parse = ThreadCounters::Sum(producer_counters,p_nums,ThreadCounters::PARSE_NS);
+        uint64_t rows = g_early != NULL ? g_early->Size()
+            : ThreadCounters::Sum(worker_counters,t_nums,ThreadCounters::ROWS);
+        double span = seconds - last_seconds ;
+        char line[512];
+        snprintf(line,sizeof(line)," PROGRESS : %.1f s , reads %llu ( %.0f /s ) , %.1f Mbp/s , input %.1f MB/s ,"
+                " kmer hits %.1f%% , queue %zu/%zu , parse %.1f s , stall %.1f s , busy %.0f%% ,"
+                " barcode rows %llu , rss %llu MB",
+                seconds,(unsigned long long)reads,( reads - last[0] ) / span ,
+                ( bases - last[1] ) / span / 1e6 , ( bytes - last[2] ) / span / 1e6 ,
+                kmers > 0 ? 100.0 * hits / kmers : 0.0 , jobs.Size() , jobs.Capacity() ,
+                parse / 1e9 , stall / 1e9 , busy + idle > 0 ? 100.0 * busy / ( busy + idle ) : 0.0 ,
+                (unsigned long long)rows , (unsigned long long)( rssKB() / 1024 ));
+        std::cerr<<line<<std::endl;
+        last_seconds = seconds ;
+        last[0] = reads ; last[1] = bases ; last[2] = bytes ;
     }
-    std::vector<std::stack< Buffer >>  caches;
-    std::mutex * locks;
+
+    MPMCQueue<Buffer*> jobs;
+    MPMCQueue<Buffer*> pool;
+    std::vector<Buffer*> buffers;
     std::thread ** threads; 
     BarcodeCache * barcode_caches;
-    BarcodeCache final_data;
+    BarcodeCache * exact_caches;
+    std::vector<std::vector<int>> votes;
+    std::vector<VoteStats> vote_stats;
+    int p_nums ;
+    ThreadCounters * worker_counters;
+    ThreadCounters * producer_counters;
+    double last_seconds ;
+    uint64_t last[3];         // reads , bases , bytes at the last progress
 };
 
-void processFastq(const std::string & file,int t_num,BarcodeCache& data){
-    std::string head;
-    std::string seq;
-    std::string tmp;
-    MultiThread mt(t_num);
-    std::istream *in ;
-    bool gz_file = false;
-    if( file.size() > 3 ) {
-        int end=file.size() ;
-        if( file[end-3] == '.' && file[end-2] == 'g' && file[end-1]=='z' ) {
-            gz_file = true ;
-        }
-    }
-    if ( gz_file )
-        in = new igzstream(file.c_str());
-    else 
-        in = new std::ifstream(file);
-    Buffer buffer ;
-    buffer.Init();
-    while(!std::getline(*in,head).eof()){
-        std::getline(*in,seq);
-        //mt.submit(head,seq);
-        buffer.heads.at(buffer.size) = head ;
-        buffer.seqs.at(buffer.size) = seq;
-        buffer.size ++ ;
-        if ( buffer.size >= max_buffer ){
-            mt.submit(buffer);
-            buffer.Init();
-        }
-        std::getline(*in,tmp);
-        std::getline(*in,tmp);
-    }
-    if( buffer.size > 0 ){
-        mt.submit(buffer);
-        buffer.Init();
-    }
-    mt.end=true;
+// see OpenByteSource
+std::istream * openInput(const std::string & file , int threads = 1){
+    return new SourceStream(OpenByteSource(file,threads));
+}
+
+// reads of one --read file , or of a --read1 / --read2 pair of files
+struct ReadInput {
+    std::string file ;
+    std::string mate ;    // file of the second reads , empty if none
+    bool interleaved ;    // records 2i and 2i+1 of file are a pair
+    ReadInput(const std::string & f , const std::string & m , bool i)
+        : file(f) , mate(m) , interleaved(i) {}
+    std::string Name() const { return mate.empty() ? file : file + " + " + mate ; }
+};
+
+// @return : false if a record of buffer has no mate , or a mate with
+// another barcode .
+bool checkPairs(const Buffer & buffer , const ReadInput & input){
+    for( int i = 0 ; i < buffer.chunk.num ; i += buffer.Step() ) {
+        const Span & head = buffer.chunk.records[i].head ;
+        const Span & mate = buffer.Mate(i)->head ;
+        Span a = barcodeSpan(head.data,head.len) , b = barcodeSpan(mate.data,mate.len);
+        if( a.len != b.len || memcmp(a.data,b.data,a.len) != 0 ) {
+            std::cerr<<"ERROR : mates \""<<std::string(head.data,head.len)<<"\" and \""
+                <<std::string(mate.data,mate.len)<<"\" of "<<input.Name()<<" have different barcodes , exit ..."<<std::endl;
+            return false ;
+        }
+    }
+    return true ;
+}
+
+// producer : index of the calling producer in mt
+// stop : set by a failed producer , the others stop at their next chunk .
+// @return : false if reads are not in pairs , stop is set then .
+bool processFastq(const ReadInput & input,int t_num,MultiThread & mt,int producer ,
+        std::atomic<bool> & stop){
+    FastqChunkReader reader(OpenByteSource(input.file,t_num),2 << 20,input.interleaved ? 2 : 1);
+    FastqChunkReader * mates = input.mate.empty() ? NULL : new FastqChunkReader(OpenByteSource(input.mate,t_num));
+    bool ok = true ;
+    while( ! stop.load(std::memory_order_relaxed) ) {
+        Buffer * buffer = mt.getBuffer(producer);
+        uint64_t start = nowNs();
+        bool more = reader.Next(buffer->chunk);
+        bool broken = input.interleaved && buffer->chunk.num % 2 != 0 ;
+        if( mates != NULL ) {
+            // mates in lockstep , the same number of records in both chunks
+            buffer->layout = Buffer::PAIRED ;
+            bool more_mates = mates->Next(buffer->mate,more ? buffer->chunk.num : 1);
+            broken = more != more_mates || buffer->mate.num != buffer->chunk.num ;
+        } else if ( input.interleaved )
+            buffer->layout = Buffer::INTERLEAVED ;
+        if( broken )
+            std::cerr<<"ERROR : reads of "<<input.Name()<<" are not in pairs , exit ..."<<std::endl;
+        else if ( buffer->layout != Buffer::SINGLE )
+            broken = ! checkPairs(*buffer,input);
+        mt.producer_counters[producer].Add(ThreadCounters::PARSE_NS,nowNs()-start);
+        if( broken ) {
+            ok = false ;
+            stop.store(true);
+        }
+        if( ! more || broken ) {
+            mt.putBuffer(buffer);
+            break;
+        }
+        mt.submit(buffer,producer);
+    }
+    delete mates ;
+    return ok ;
+}
+
+// counters of the read pass , kept after its MultiThread is gone
+struct ReadCounters {
+    int workers , producers ;
+    size_t queue ;    // capacity of the job queue
+    std::vector<std::vector<uint64_t> > worker , producer ; // ThreadCounters values
+    ReadCounters() : workers(0) , producers(0) , queue(0) {}
+    void Save(const MultiThread & mt){
+        workers = mt.t_nums ;
+        producers = mt.p_nums ;
+        queue = mt.jobs.Capacity() ;
+        worker.assign(workers,std::vector<uint64_t>(ThreadCounters::NUM));
+        producer.assign(producers,std::vector<uint64_t>(ThreadCounters::NUM));
+        for( int i = 0 ; i < ThreadCounters::NUM ; i ++ ) {
+            for( int t = 0 ; t < workers ; t ++ ) worker[t][i] = mt.worker_counters[t].Get(i);
+            for( int t = 0 ; t < producers ; t ++ ) producer[t][i] = mt.producer_counters[t].Get(i);
+        }
+    }
+    static uint64_t Sum(const std::vector<std::vector<uint64_t> > & threads , int i){
+        uint64_t sum = 0 ;
+        for( const auto & t : threads ) sum += t[i];
+        return sum ;
+    }
+    uint64_t Worker(int i) const { return Sum(worker,i) ; }
+    uint64_t Producer(int i) const { return Sum(producer,i) ; }
+};
+ReadCounters g_read_counters;
+
+// all files go through one worker pool , r_num files ( or pairs of files )
+// are read at the same time , t_num inflate threads are shared by the readers.
+// @return : false if reads of a file are not in pairs , all threads are
+// stopped and joined then , data is not complete .
+bool processFastqs(const std::vector<ReadInput> & files , int t_num , int r_num ,
+        BarcodeCache & data , VoteStats & stats , BarcodeCache * exact = NULL){
+    r_num = std::max(1,std::min(r_num,(int)files.size()));
+    int inflate_num = std::max(1,t_num/r_num);
+    MultiThread mt(t_num,r_num);
+    ProgressReporter reporter(g_progress,[&mt](double seconds){ mt.progress(seconds); });
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stop(false);
+    std::mutex log_lock;
+    std::vector<std::thread> readers;
+    for( int i = 0 ; i < r_num ; i ++ ) {
+        readers.push_back(std::thread([&,i](){
+            size_t f ;
+            while( ! stop.load() && ( f = next.fetch_add(1) ) < files.size() ) {
+                {
+                    std::lock_guard<std::mutex> guard(log_lock);
+                    std::cerr<<"__process read: "<<files[f].Name()<<std::endl;
+                }
+                if( ! processFastq(files[f],inflate_num,mt,i,stop) ) return ;
+                std::lock_guard<std::mutex> guard(log_lock);
+                std::cerr<<"__process read done: "<<files[f].Name()<<std::endl;
+            }
+        }));
+    }
+    for( auto & t : readers ) t.join();
     mt.wait();
-    mt.collectBarcodes();
-    data.Add(mt.final_data);
+    reporter.Stop();
+    if( stop.load() ) return false ;
+    g_read_counters.Save(mt);
+    g_stages.Mark("classify");
+    mt.collectBarcodes(data,stats,exact);
+    g_stages.Mark("merge");
+    return true ;
+}
+
+// compare calls of sampled lookups with calls of exhaustive lookups.
+void printSampleCompare(const BarcodeCache & data , const BarcodeCache & exact ,
+        const VoteStats & stats){
+    uint64_t same = 0 , lost = 0 , gained = 0 , swapped = 0 ;
+    for( size_t r = 0 ; r < exact.Size() ; r ++ ) {
+        std::string name = barcodeName(exact.barcodes[r]);
+        int e = getHap(name,exact.Counts(r));
+        long row = data.Find(exact.barcodes[r]);
+        int s = row < 0 ? -1 : getHap(name,data.Counts(row));
+        if( s == e ) same ++ ;
+        else if ( s == -1 ) lost ++ ;
+        else if ( e == -1 ) gained ++ ;
+        else swapped ++ ;
+    }
+    double total = exact.Size() > 0 ? exact.Size() : 1 ;
+    std::cerr<<" INFO : sampled lookups "<<stats.kmers<<" , exhaustive lookups "<<stats.exact_kmers
+        <<" ( "<<( stats.kmers > 0 ? (double)stats.exact_kmers / stats.kmers : 0.0 )<<" times )"<<std::endl;
+    std::cerr<<" INFO : barcodes "<<exact.Size()<<" , same call "<<same<<" ( "<<100.0*same/total<<"% )"
+        <<" , called -> -1 "<<lost<<" , -1 -> called "<<gained<<" , changed haplotype "<<swapped<<std::endl;
 }
 
+void printVoteStats(const VoteStats & stats , bool filter){
+    double total = stats.kmers > 0 ? stats.kmers : 1 ;
+    std::cerr<<" INFO : kmer lookups "<<stats.kmers
+        <<" , hits "<<stats.hits<<" ( "<<100.0*stats.hits/total<<"% )"
+        <<" , reads without kmer "<<stats.no_kmer<<std::endl;
+    if( g_early != NULL )
+        std::cerr<<" INFO : early decision skipped "<<stats.skipped<<" reads"<<std::endl;
+    if( ! filter ) return ;
+    uint64_t passed = stats.kmers - stats.rejected ;
+    uint64_t misses = stats.kmers - stats.hits ;
+    std::cerr<<" INFO : filter rejected "<<stats.rejected<<" ( "<<100.0*stats.rejected/total<<"% )"
+        <<" , passed "<<passed<<" , false positive rate "
+        <<( misses > 0 ? (double)( passed - stats.hits ) / misses : 0.0 )<<std::endl;
+}
+
+// kmer hits of every haplotype , column sums of data
+std::vector<uint64_t> hapHits(const BarcodeCache & data){
+    std::vector<uint64_t> hits(g_hap_num,0);
+    for( size_t r = 0 ; r < data.Size() ; r ++ ) {
+        const uint32_t * row = data.Counts(r);
+        for( int i = 0 ; i < g_hap_num ; i ++ ) hits[i] += row[i+1];
+    }
+    return hits ;
+}
+
+// which side limits the read pass , from busy time of workers and readers
+std::string boundBy(const ReadCounters & c , double seconds){
+    uint64_t busy = c.Worker(ThreadCounters::BUSY_NS) , idle = c.Worker(ThreadCounters::IDLE_NS);
+    double worker = busy + idle > 0 ? (double)busy / ( busy + idle ) : 0 ;
+    double reader = seconds > 0 && c.producers > 0 ?
+        c.Producer(ThreadCounters::PARSE_NS) / 1e9 / c.producers / seconds : 0 ;
+    if( worker >= 0.8 ) return "workers ( kmer lookup ) , add --thread" ;
+    if( reader >= 0.8 ) return "readers ( io , inflate and parse ) , add --reader or --thread" ;
+    return "neither , workers and readers both wait" ;
+}
+
+double stageSeconds(const std::string & name){
+    for( const auto & stage : g_stages.Stages() )
+        if( stage.first == name ) return stage.second ;
+    return 0 ;
+}
+
+// final stage times and counters
+void printTelemetry(const BarcodeCache & data , const VoteStats & stats ,
+        const std::vector<std::string> & haps){
+    for( const auto & stage : g_stages.Stages() )
+        std::cerr<<" INFO : stage "<<stage.first<<" "<<stage.second<<" s"<<std::endl;
+    const ReadCounters & c = g_read_counters ;
+    double seconds = stageSeconds("classify");
+    uint64_t bytes = c.Worker(ThreadCounters::BYTES);
+    std::cerr<<" INFO : reads "<<c.Worker(ThreadCounters::READS)<<" , bases "<<c.Worker(ThreadCounters::BASES)
+        <<" , input "<<bytes<<" bytes ( "<<( seconds > 0 ? bytes / seconds / 1e6 : 0 )<<" MB/s )"<<std::endl;
+    uint64_t chunks = c.Producer(ThreadCounters::CHUNKS);
+    std::cerr<<" INFO : "<<c.producers<<" readers : parse "<<c.Producer(ThreadCounters::PARSE_NS)/1e9
+        <<" s , stall "<<c.Producer(ThreadCounters::STALL_NS)/1e9<<" s , queue depth mean "
+        <<( chunks > 0 ? (double)c.Producer(ThreadCounters::DEPTH_SUM) / chunks : 0 )
+        <<" max "<<c.Producer(ThreadCounters::DEPTH_MAX)<<" of "<<c.queue<<std::endl;
+    std::cerr<<" INFO : "<<c.workers<<" workers : busy "<<c.Worker(ThreadCounters::BUSY_NS)/1e9
+        <<" s , idle "<<c.Worker(ThreadCounters::IDLE_NS)/1e9<<" s"<<std::endl;
+    std::cerr<<" INFO : bound by "<<boundBy(c,seconds)<<std::endl;
+    std::vector<uint64_t> hits = hapHits(data);
+    double total = stats.kmers > 0 ? stats.kmers : 1 ;
+    for( int i = 0 ; i < g_hap_num ; i ++ )
+        std::cerr<<" INFO : haplotype "<<getSpeciesName(haps.at(i))<<" kmer hits "<<hits[i]
+            <<" ( "<<100.0*hits[i]/total<<"% of lookups )"<<std::endl;
+    std::cerr<<" INFO : barcodes "<<data.Size()<<" , peak rss "<<peakRssKB()/1024<<" MB"<<std::endl;
+}
+
+std::string jsonString(const std::string & str){
+    std::string ret("\"");
+    for( char c : str ) {
+        if( c == '"' || c == '\\' ) ret += '\\' ;
+        if( (unsigned char)c < 0x20 ) {
+            char hex[8];
+            snprintf(hex,sizeof(hex),"\\u%04x",c);
+            ret += hex ;
+        } else
+            ret += c ;
+    }
+    return ret + '"' ;
+}
+
+// the same as printTelemetry , for machines
+void saveStats(const std::string & file , const BarcodeCache & data ,
+        const VoteStats & stats , const std::vector<std::string> & haps){
+    static const char * names[ThreadCounters::NUM] = {
+        "reads" , "bases" , "bytes" , "barcode_rows" , "kmers" , "hits" ,
+        "busy_ns" , "idle_ns" , "parse_ns" , "stall_ns" , "chunks" , "depth_sum" , "depth_max" };
+    static const int worker_values[] = { ThreadCounters::READS , ThreadCounters::BASES ,
+        ThreadCounters::BYTES , ThreadCounters::ROWS , ThreadCounters::KMERS , ThreadCounters::HITS ,
+        ThreadCounters::BUSY_NS , ThreadCounters::IDLE_NS };
+    static const int producer_values[] = { ThreadCounters::PARSE_NS , ThreadCounters::STALL_NS ,
+        ThreadCounters::CHUNKS , ThreadCounters::DEPTH_SUM , ThreadCounters::DEPTH_MAX };
+    const ReadCounters & c = g_read_counters ;
+    std::ofstream ofs(file);
+    ofs<<"{\n  \"version\": 1,\n  \"wall_seconds\": "<<g_stages.Elapsed()
+        <<",\n  \"peak_rss_kb\": "<<peakRssKB()<<",\n  \"stages\": {";
+    const auto & stages = g_stages.Stages();
+    for( size_t i = 0 ; i < stages.size() ; i ++ )
+        ofs<<( i > 0 ? ", " : "" )<<jsonString(stages[i].first)<<": "<<stages[i].second;
+    ofs<<"},\n  \"kmer_lookups\": "<<stats.kmers<<",\n  \"kmer_hits\": "<<stats.hits
+        <<",\n  \"filter_rejected\": "<<stats.rejected<<",\n  \"skipped_reads\": "<<stats.skipped
+        <<",\n  \"no_kmer_reads\": "<<stats.no_kmer
+        <<",\n  \"barcodes\": "<<data.Size()<<",\n  \"queue_capacity\": "<<c.queue
+        <<",\n  \"haplotypes\": [";
+    std::vector<uint64_t> hits = hapHits(data);
+    for( int i = 0 ; i < g_hap_num ; i ++ )
+        ofs<<( i > 0 ? "," : "" )<<"\n    {\"name\": "<<jsonString(haps.at(i))<<", \"kmer_hits\": "<<hits[i]<<"}";
+    ofs<<"\n  ],\n  \"workers\": [";
+    for( int t = 0 ; t < c.workers ; t ++ ) {
+        ofs<<( t > 0 ? "," : "" )<<"\n    {";
+        for( size_t i = 0 ; i < sizeof(worker_values)/sizeof(int) ; i ++ )
+            ofs<<( i > 0 ? ", " : "" )<<'"'<<names[worker_values[i]]<<"\": "<<c.worker[t][worker_values[i]];
+        ofs<<"}";
+    }
+    ofs<<"\n  ],\n  \"readers\": [";
+    for( int t = 0 ; t < c.producers ; t ++ ) {
+        ofs<<( t > 0 ? "," : "" )<<"\n    {";
+        for( size_t i = 0 ; i < sizeof(producer_values)/sizeof(int) ; i ++ )
+            ofs<<( i > 0 ? ", " : "" )<<'"'<<names[producer_values[i]]<<"\": "<<c.producer[t][producer_values[i]];
+        ofs<<"}";
+    }
+    ofs<<"\n  ]\n}\n";
+    ofs.close();
+    if( ! ofs ) {
+        std::cerr<<"ERROR : failed to write stats file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
+    }
+}
+
+//
+// split reads by the haplotype of their barcode , one pass per input :
+//   hap i  -> <species i>.<read name>
+//   hap -1 -> homozygous.<read name>
+// species name is the haplotype file name without directory and the
+// ".t2.unique.filter.mer" suffix , read name is the read file name without
+// directory and ".gz" . reads without '#' in head are dropped , the same as
+// filter_fq_by_barcodes.awk .
+//
+struct ReadSplitter {
+    struct Output {
+        FILE * fp ;
+        BgzfWriter * gz ;
+        void Write(const char * data , size_t len){
+            if( gz != NULL ) gz->Write(data,len);
+            else fwrite(data,1,len,fp);
+        }
+        void Close(const std::string & name){
+            if( gz != NULL ) { gz->Close(); delete gz ; return ; }
+            if( fclose(fp) != 0 ) {
+                std::cerr<<"ERROR : failed to write \""<<name<<"\" , exit ..."<<std::endl;
+                exit(1);
+            }
+        }
+    };
+
+    ReadSplitter(const BarcodeCache & d , const std::vector<std::string> & haps ,
+            bool gz_out , int threads) : data(d) , t_num(threads) , pool(NULL) {
+        const std::string suffix(".t2.unique.filter.mer");
+        for( const auto & hap : haps ) {
+            std::string name = hap.substr(hap.find_last_of('/')+1);
+            if( name.size() > suffix.size()
+                    && name.compare(name.size()-suffix.size(),suffix.size(),suffix) == 0 )
+                name.resize(name.size()-suffix.size());
+            species.push_back(name);
+        }
+        species.push_back("homozygous");
+        row_haps.resize(data.Size());
+        for( size_t r = 0 ; r < data.Size() ; r ++ )
+            row_haps[r] = getHap(barcodeName(data.barcodes[r]),data.Counts(r));
+        if( gz_out )
+            pool = new BgzfCompressPool(t_num);
+    }
+    ~ReadSplitter() { delete pool ; }
+
+    void Split(const std::string & file){
+        std::string name = file.substr(file.find_last_of('/')+1);
+        if( name.size() > 3 && name.compare(name.size()-3,3,".gz") == 0 )
+            name.resize(name.size()-3);
+        std::vector<Output> outs(species.size());
+        std::vector<std::string> out_names(species.size());
+        for( size_t i = 0 ; i < species.size() ; i ++ ) {
+            out_names[i] = species[i] + "." + name + ( pool != NULL ? ".gz" : "" );
+            outs[i].fp = NULL ;
+            outs[i].gz = NULL ;
+            if( pool != NULL ) {
+                outs[i].gz = new BgzfWriter(out_names[i],pool);
+                continue ;
+            }
+            outs[i].fp = fopen(out_names[i].c_str(),"wb");
+            if( outs[i].fp == NULL ) {
+                std::cerr<<"ERROR : failed to open \""<<out_names[i]<<"\" , exit ..."<<std::endl;
+                exit(1);
+            }
+            setvbuf(outs[i].fp,NULL,_IOFBF,1<<20);
+        }
+        int homozygous = species.size() - 1 ;
+        FastqChunkReader reader(OpenByteSource(file,t_num));
+        FastqChunk chunk;
+        while( reader.Next(chunk) ) {
+            for( int i = 0 ; i < chunk.num ; i ++ ) {
+                const FastqRecord & record = chunk.records[i];
+                if( memchr(record.head.data,'#',record.head.len) == NULL ) continue ;
+                long row = data.Find(parseBarcode(record.head.data,record.head.len));
+                if( row < 0 ) continue ;
+                int hap = row_haps[row];
+                Output & out = outs[ hap < 0 ? homozygous : hap ];
+                out.Write(record.raw.data,record.raw.len);
+                if( record.raw.data[record.raw.len-1] != '\n' )
+                    out.Write("\n",1);
+            }
+        }
+        for( size_t i = 0 ; i < outs.size() ; i ++ )
+            outs[i].Close(out_names[i]);
+    }
+
+    const BarcodeCache & data ;
+    int t_num ;
+    BgzfCompressPool * pool ;
+    std::vector<std::string> species ;
+    std::vector<int> row_haps ;
+};
+
 void InitAdaptor(){
     //std::string r1("CTGTCTCTTATACACATCTTAGGAAGACAAGCACTGACGACATGATCACCAAGGATCGCCATAGTCCATGCTAAAGGACGTCAGGAAGGGCGATCTCAGG");
     //std::string r2("TCTGCTGAGTCGAGAACGTCTCTGTGAGCCAAGGAGTTGCTCTGGCGACGGCCACGAAGCTAACAGCCAATCTGCGTAACAGCCAAACCTGAGATCGCCC");
     std::string r1("CTGTCTCTTATACACATCTTAGGAAGACAAGCACTGACGACATGA");
     std::string r2("TCTGCTGAGTCGAGAACGTCTCTGTGAGCCAAGGAGTTGCTCTGG");
 
-    std::vector<Kmer> kmers = Kmer::chopRead2Kmer(BaseStr::str2BaseStr(r1));
-    for(int i = 0 ; i <(int)kmers.size();i++){
-    //for(int i = 0 ; i <(int)r1.size()-g_K+1;i++){
-        const Kmer & kmer = kmers.at(i);
-        //std::string kmer = get_cannonical(r1.substr(i,g_K));
-        for ( int j = 0 ; j < (int)g_kmers.size() ; j ++ ){
-            if( g_kmers[j].find(kmer) != g_kmers[j].end() ){
-                g_kmers[j].erase(kmer);
-                std::cerr<<" INFO : erase adaptor kmer from hap "<<j<<" ; kmer="<<BaseStr::BaseStr2Str(Kmer::ToBaseStr(kmer))<<std::endl;
+    g_kmers->EraseAdaptor(r1);
+    g_kmers->EraseAdaptor(r2);
+}
+
+static bool isACGT(char c) {
+    switch(c) {
+        case 'A': case 'C': case 'G': case 'T':
+        case 'a': case 'c': case 'g': case 't':
+            return true;
+        default :
+            return false;
+    }
+}
+
+// call f(kmer) for every canonical kmer of a reference ,
+// kmers never span fasta records nor non-ACGT bases.
+template<class KmerType , class F>
+void forEachRefKmer(const std::string & file , F f){
+    std::istream * in = openInput(file);
+    CanonicalKmerIterator<KmerType> it(NULL,0);
+    KmerType kmer;
+    std::string line;
+    while( std::getline(*in,line) ) {
+        if( ! line.empty() && line[0] == '>' ) {
+            it.Restart(NULL,0);
+            continue;
+        }
+        int len = line.size();
+        for( int s = 0 , i = 0 ; i <= len ; i ++ ) {
+            if( i < len && isACGT(line[i]) ) continue ;
+            it.Continue(line.data() + s , i - s);
+            while( it.Next(kmer) ) f(kmer);
+            if( i < len ) it.Restart(NULL,0);
+            s = i + 1 ;
+        }
+    }
+    delete in ;
+}
+
+// write kmers of every tables[i].slots into outs[owner(slot)] by t_num
+// threads , one text buffer per file per thread . owner < 0 or an empty
+// out skips the slot .
+// @return : kmers written into every out
+template<int K , class Table , class Owner>
+std::vector<long> writeKmerFiles(const std::vector<Table> & tables ,
+        const std::vector<std::string> & outs , int t_num , Owner owner){
+    int out_num = outs.size();
+    std::vector<std::ofstream> ofs(out_num);
+    std::vector<std::mutex> ofs_locks(out_num);
+    std::vector<long> totals(out_num,0);
+    for( int i = 0 ; i < out_num ; i ++ ) {
+        if( outs[i].empty() ) continue ;
+        ofs[i].open(outs[i]);
+        if( ! ofs[i] ) {
+            std::cerr<<"ERROR : failed to open \""<<outs[i]<<"\" , exit ..."<<std::endl;
+            exit(1);
+        }
+    }
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for( int t = 0 ; t < t_num ; t ++ ) {
+        threads.push_back(std::thread([&](){
+            std::vector<std::string> buffers(out_num);
+            std::vector<long> counts(out_num,0);
+            auto write = [&](int i){
+                std::lock_guard<std::mutex> guard(ofs_locks[i]);
+                ofs[i]<<buffers[i];
+                buffers[i].clear();
+            };
+            for( size_t n ; ( n = next ++ ) < tables.size() ; ) {
+                for( const auto & slot : tables[n].slots ) {
+                    int i = owner(slot);
+                    if( i < 0 || outs[i].empty() ) continue ;
+                    std::string & buffer = buffers[i];
+                    for( int j = 0 ; j < K ; j ++ )
+                        buffer += BaseStr::int2base(slot.key.baseAt(j));
+                    buffer += '\n';
+                    counts[i] ++ ;
+                    if( buffer.size() >= ( 1 << 20 ) )
+                        write(i);
+                }
+            }
+            for( int i = 0 ; i < out_num ; i ++ ) {
+                if( outs[i].empty() ) continue ;
+                write(i);
+                std::lock_guard<std::mutex> guard(ofs_locks[i]);
+                totals[i] += counts[i];
             }
+        }));
+    }
+    for( auto & t : threads ) t.join();
+    for( int i = 0 ; i < out_num ; i ++ ) {
+        if( outs[i].empty() ) continue ;
+        ofs[i].close();
+        if( ! ofs[i] ) {
+            std::cerr<<"ERROR : failed to write \""<<outs[i]<<"\" , exit ..."<<std::endl;
+            exit(1);
         }
     }
-    std::vector<Kmer> kmers2 = Kmer::chopRead2Kmer(BaseStr::str2BaseStr(r2));
-    for(int i = 0 ; i <(int)kmers2.size();i++){
-    //for(int i = 0 ; i <(int)r1.size()-g_K+1;i++){
-        const Kmer & kmer = kmers2.at(i);
-        //std::string kmer = get_cannonical(r1.substr(i,g_K));
-        for ( int j = 0 ; j < (int)g_kmers.size() ; j ++ ){
-            if( g_kmers[j].find(kmer) != g_kmers[j].end() ){
-                g_kmers[j].erase(kmer);
-                std::cerr<<" INFO : erase adaptor kmer from hap "<<j<<" ; kmer="<<BaseStr::BaseStr2Str(Kmer::ToBaseStr(kmer))<<std::endl;
+    return totals ;
+}
+
+// g_kmers = kmers of every tables[i].slots owned by haplotype owner(slot) ,
+// see writeKmerFiles . total : kmers expected .
+template<int K , class Table , class Owner>
+void buildIndexFrom(const std::vector<Table> & tables , size_t total , int hap_num ,
+        int t_num , Owner owner){
+    KmerHapIndex<K> * hap_index = new KmerHapIndex<K>();
+    typedef typename KmerHapIndex<K>::Inserter Inserter;
+    Inserter inserter(hap_index->table,total);
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> threads;
+    for( int t = 0 ; t < t_num ; t ++ ) {
+        threads.push_back(std::thread([&](){
+            typename Inserter::Batch batch(inserter);
+            for( size_t n ; ( n = next ++ ) < tables.size() ; ) {
+                for( const auto & slot : tables[n].slots ) {
+                    int hap = owner(slot);
+                    if( hap >= 0 )
+                        batch.Add(slot.key,hap_index->table.HashOf(slot.key),hap);
+                }
             }
+            batch.Flush();
+        }));
+    }
+    for( auto & t : threads ) t.join();
+    inserter.Finish();
+    delete g_kmers ;
+    g_kmers = hap_index ;
+    g_K = K ;
+    g_hap_num = hap_num ;
+    InitAdaptor();
+}
+
+//
+// kmer tables cut by the top SHARD_BITS bits of kmer hash , each behind its
+// own lock , so threads counting references rarely wait for each other .
+// a thread keeps up to FLUSH_SIZE items per shard in its Pending and locks
+// a shard once per flush .
+//
+template<class KmerType , class Table>
+struct KmerShards {
+    static const int SHARD_BITS = 8 ;
+    static const int SHARD_NUM = 1 << SHARD_BITS ;
+    static const size_t FLUSH_SIZE = 4096 ;
+    std::vector<Table> tables;
+    std::mutex locks[SHARD_NUM];
+    KmerShards() : tables(SHARD_NUM) {}
+
+    static int ShardOf(const KmerType & kmer) {
+        return (int)( kmer.hash() >> ( 64 - SHARD_BITS ) );
+    }
+    // apply(table,items) is called with the lock of the shard held
+    template<class Item>
+    struct Pending {
+        KmerShards & shards ;
+        std::vector<std::vector<Item> > items ;
+        explicit Pending(KmerShards & s) : shards(s) , items(SHARD_NUM) {}
+        template<class F>
+        void Add(const KmerType & kmer , const Item & item , F apply){
+            int shard = ShardOf(kmer);
+            items[shard].push_back(item);
+            if( items[shard].size() >= FLUSH_SIZE )
+                Flush(shard,apply);
+        }
+        template<class F>
+        void Flush(int shard , F apply){
+            std::lock_guard<std::mutex> guard(shards.locks[shard]);
+            apply(shards.tables[shard],items[shard]);
+            items[shard].clear();
+        }
+        template<class F>
+        void FlushAll(F apply){
+            for( int shard = 0 ; shard < SHARD_NUM ; shard ++ ) Flush(shard,apply);
+        }
+    };
+};
+
+//
+// extract species unique kmers from references , replace the jellyfish stages.
+//   a kmer is kept for species s if it appears in s only and its count in s
+//   is in [lower,upper] .
+// references are counted in parallel in one pass , kmers go to table shards
+// chosen by hash so threads rarely wait for each other .
+//
+struct UniqueExtractor {
+    virtual ~UniqueExtractor() {}
+    // write unique kmers of refs[i] into outs[i] , and into index file if any.
+    virtual void Run(const std::vector<std::string> & refs ,
+            const std::vector<std::string> & outs ,
+            int lower , int upper , int t_num , const std::string & index) = 0 ;
+};
+
+template<int K>
+struct KmerUniqueExtractor : public UniqueExtractor {
+    typedef KmerT<K> KmerType;
+    typedef KmerSpeciesTable<KmerType> Table;
+    typedef KmerShards<KmerType,Table> Shards;
+
+    Shards shards;
+
+    void count(const std::string & file , int species){
+        typename Shards::template Pending<KmerType> pending(shards);
+        auto add = [species](Table & table , const std::vector<KmerType> & kmers){
+            for( const KmerType & kmer : kmers ) table.Add(kmer,species);
+        };
+        forEachRefKmer<KmerType>(file,[&](const KmerType & kmer){ pending.Add(kmer,kmer,add); });
+        pending.FlushAll(add);
+    }
+
+    void Run(const std::vector<std::string> & refs ,
+            const std::vector<std::string> & outs ,
+            int lower , int upper , int t_num , const std::string & index) {
+        int species_num = refs.size();
+        std::atomic<int> next(0);
+        std::vector<std::thread> threads;
+        for( int t = 0 ; t < t_num ; t ++ ) {
+            threads.push_back(std::thread([&](){
+                for( int i ; ( i = next ++ ) < species_num ; ) {
+                    std::cerr<<"__count kmers of "<<refs[i]<<std::endl;
+                    count(refs[i],i);
+                }
+            }));
+        }
+        for( auto & t : threads ) t.join();
+        logtime();
+        auto owner = [lower,upper](const typename Table::Slot & slot){
+            if( slot.species >= Table::MULTI ) return -1 ;
+            if( (uint32_t)lower > slot.count || (uint32_t)upper < slot.count ) return -1 ;
+            return (int)slot.species ;
+        };
+        std::vector<long> totals = writeKmerFiles<K>(shards.tables,outs,t_num,owner);
+        long total = 0 ;
+        for( int i = 0 ; i < species_num ; i ++ ) {
+            total += totals[i];
+            std::cerr<<"Extracted "<<totals[i]<<" species "<<i<<" unique "<<K<<"-mers into "<<outs[i]<<std::endl;
+        }
+        if( index.empty() ) return ;
+        // build index from unique kmers directly
+        buildIndexFrom<K>(shards.tables,total,species_num,t_num,owner);
+        std::vector<Table>().swap(shards.tables);
+        save_index(index,outs);
+    }
+};
+
+//
+// persistent species panel , kept up to date by "classify panel" :
+//   every kmer of every species , with how many species have it and how
+//   many of them have it [lower,upper] times , see KmerPanelTable . adding
+//   or removing a species counts only its own reference , then only the
+//   unique kmer files of species whose unique set changed are written .
+//   file : PanelHeader | species lines | live slots
+//   species line : id \t distinct kmers \t generation added \t reference
+// generation goes up by one at every update .
+//
+#define PANEL_MAGIC "MSLRPNL"
+#define PANEL_VERSION 1
+struct PanelHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t K;
+    uint32_t lower;
+    uint32_t upper;
+    uint64_t generation;
+    uint32_t next_id;     // ids are never reused
+    uint32_t slot_size;
+    uint64_t species_size;
+    uint64_t slots;
+};
+
+struct PanelSpecies {
+    int id ;
+    long kmers ;          // distinct kmers of ref , checked when removed
+    uint64_t generation ;
+    std::string ref ;
+    // the unique kmer file , named as extract-unique does
+    std::string Out() const { return ref.substr(ref.find_last_of('/')+1) + ".t2.unique.filter.mer" ; }
+};
+
+struct Panel {
+    PanelHeader header ;
+    std::vector<PanelSpecies> species ;
+    virtual ~Panel() {}
+    // @return : false if slots of header are not of this panel
+    virtual bool ReadSlots(std::istream & in , const PanelHeader & header) = 0 ;
+    // @return : live slots written
+    virtual uint64_t WriteSlots(std::ostream & out) const = 0 ;
+    virtual uint32_t SlotSize() const = 0 ;
+    // count refs[i] and add it as species ids[i] , or remove it .
+    // expect[i] > 0 : distinct kmers refs[i] must have .
+    // changed[id] is set for species whose unique kmers changed .
+    // @return : distinct kmers of every ref
+    virtual std::vector<long> Update(const std::vector<std::string> & refs , const std::vector<int> & ids ,
+            const std::vector<long> & expect , bool remove , int t_num , std::vector<char> & changed) = 0 ;
+    // write unique kmers of every species with changed[id]
+    virtual void WriteUnique(const std::vector<char> & changed , int t_num) = 0 ;
+    // set g_kmers to unique kmers of all species , in the order of species
+    virtual void BuildIndex(int t_num) = 0 ;
+};
+
+template<int K>
+struct KmerPanel : public Panel {
+    typedef KmerT<K> KmerType;
+    typedef KmerPanelTable<KmerType> Table;
+    typedef typename Table::Slot Slot;
+    typedef KmerShards<KmerType,Table> Shards;
+    typedef std::pair<KmerType,bool> Item;    // kmer , passed
+
+    Shards shards;
+
+    uint32_t SlotSize() const { return sizeof(Slot) ; }
+    bool ReadSlots(std::istream & in , const PanelHeader & saved){
+        if( saved.slot_size != sizeof(Slot) ) return false ;
+        uint64_t n = saved.slots ;
+        for( auto & table : shards.tables ) table.Reserve(n / Shards::SHARD_NUM * 1.1);
+        std::vector<Slot> buffer(1 << 16);
+        for( uint64_t done = 0 ; done < n ; ) {
+            size_t m = std::min<uint64_t>(buffer.size(),n - done);
+            if( ! in.read((char *)buffer.data(),m * sizeof(Slot)) ) break ;
+            for( size_t i = 0 ; i < m ; i ++ ) shards.tables[Shards::ShardOf(buffer[i].key)].Put(buffer[i]);
+            done += m ;
+        }
+        return true ;
+    }
+    uint64_t WriteSlots(std::ostream & out) const {
+        std::vector<Slot> buffer;
+        uint64_t n = 0 ;
+        for( const auto & table : shards.tables ) {
+            for( const Slot & slot : table.slots ) {
+                if( ! Table::Live(slot) ) continue ;
+                buffer.push_back(slot);
+                if( buffer.size() >= ( 1 << 16 ) ) {
+                    out.write((const char *)buffer.data(),buffer.size() * sizeof(Slot));
+                    n += buffer.size();
+                    buffer.clear();
+                }
+            }
+        }
+        out.write((const char *)buffer.data(),buffer.size() * sizeof(Slot));
+        return n + buffer.size() ;
+    }
+    static void apply(Table & table , const std::vector<Item> & items , int id , bool remove ,
+            std::vector<char> & changed , const std::string & ref){
+        for( const auto & kmer : items ) {
+            std::pair<int,int> owners = remove ? table.Remove(kmer.first,id,kmer.second)
+                : table.Add(kmer.first,id,kmer.second);
+            if( owners.first == -2 ) {
+                std::cerr<<"ERROR : \""<<ref<<"\" changed since it was added to the panel , exit ..."<<std::endl;
+                exit(1);
+            }
+            if( owners.first == owners.second ) continue ;
+            if( owners.first >= 0 ) changed[owners.first] = 1 ;
+            if( owners.second >= 0 ) changed[owners.second] = 1 ;
+        }
+    }
+    // one reference per thread : count it , then add it to the shards
+    std::vector<long> Update(const std::vector<std::string> & refs , const std::vector<int> & ids ,
+            const std::vector<long> & expect , bool remove , int t_num , std::vector<char> & changed){
+        std::vector<long> kmers(refs.size(),0);
+        std::atomic<size_t> next(0);
+        std::mutex lock;
+        std::vector<std::thread> threads;
+        for( int t = 0 ; t < t_num ; t ++ ) {
+            threads.push_back(std::thread([&](){
+                std::vector<char> seen(changed.size(),0);
+                typename Shards::template Pending<Item> pending(shards);
+                for( size_t i ; ( i = next ++ ) < refs.size() ; ) {
+                    std::cerr<<"__count kmers of "<<refs[i]<<std::endl;
+                    KmerSpeciesTable<KmerType> counts;
+                    forEachRefKmer<KmerType>(refs[i],[&](const KmerType & kmer){ counts.Add(kmer,0); });
+                    kmers[i] = counts.Size();
+                    if( expect[i] > 0 && kmers[i] != expect[i] ) {
+                        std::cerr<<"ERROR : \""<<refs[i]<<"\" has "<<kmers[i]<<" kmers , but had "<<expect[i]
+                            <<" when it was added to the panel , exit ..."<<std::endl;
+                        exit(1);
+                    }
+                    auto update = [&](Table & table , const std::vector<Item> & items){
+                        apply(table,items,ids[i],remove,seen,refs[i]);
+                    };
+                    for( const auto & slot : counts.slots ) {
+                        if( slot.species == KmerSpeciesTable<KmerType>::EMPTY ) continue ;
+                        pending.Add(slot.key,Item(slot.key,
+                                    header.lower <= slot.count && slot.count <= header.upper),update);
+                    }
+                    pending.FlushAll(update);
+                }
+                std::lock_guard<std::mutex> guard(lock);
+                for( size_t id = 0 ; id < seen.size() ; id ++ ) changed[id] |= seen[id];
+            }));
         }
+        for( auto & t : threads ) t.join();
+        return kmers ;
+    }
+    // species index of every id , -1 if not in panel
+    std::vector<int> speciesIndex() const {
+        std::vector<int> index(header.next_id,-1);
+        for( size_t i = 0 ; i < species.size() ; i ++ ) index[species[i].id] = i ;
+        return index ;
+    }
+    void WriteUnique(const std::vector<char> & changed , int t_num){
+        std::vector<int> index = speciesIndex();
+        std::vector<std::string> outs(species.size());
+        for( size_t i = 0 ; i < species.size() ; i ++ )
+            if( changed[species[i].id] ) outs[i] = species[i].Out();
+        std::vector<long> totals = writeKmerFiles<K>(shards.tables,outs,t_num,[&index](const Slot & slot){
+            int id = Table::Owner(slot);
+            return id < 0 ? -1 : index[id] ;
+        });
+        for( size_t i = 0 ; i < species.size() ; i ++ )
+            if( ! outs[i].empty() )
+                std::cerr<<"Extracted "<<totals[i]<<" species "<<species[i].id<<" unique "<<K<<"-mers into "<<outs[i]<<std::endl;
+    }
+    void BuildIndex(int t_num){
+        std::vector<int> index = speciesIndex();
+        size_t total = 0 ;
+        for( const auto & table : shards.tables )
+            for( const Slot & slot : table.slots )
+                total += Table::Owner(slot) >= 0 ;
+        buildIndexFrom<K>(shards.tables,total,species.size(),t_num,[&index](const Slot & slot){
+            int id = Table::Owner(slot);
+            return id < 0 ? -1 : index[id] ;
+        });
+    }
+};
+
+Panel * load_panel(const std::string & file){
+    std::ifstream ifs(file,std::ios::binary);
+    PanelHeader header;
+    if( ! ifs.read((char *)&header,sizeof(header))
+            || memcmp(header.magic,PANEL_MAGIC,sizeof(PANEL_MAGIC)) != 0
+            || header.version != PANEL_VERSION ) {
+        std::cerr<<"ERROR : \""<<file<<"\" is not a valid panel file , exit ..."<<std::endl;
+        exit(1);
+    }
+    Panel * panel = KDispatch<KmerPanel,Panel,MAX_K>::Create(header.K);
+    if( panel == NULL ) {
+        std::cerr<<"ERROR : kmer size "<<header.K<<" of panel \""<<file<<"\" is not supported , exit ..."<<std::endl;
+        exit(1);
     }
+    panel->header = header ;
+    std::string lines(header.species_size,'\0');
+    ifs.read(&lines[0],lines.size());
+    std::istringstream iss(lines);
+    PanelSpecies species;
+    while( iss>>species.id>>species.kmers>>species.generation && iss.get() == '\t'
+            && std::getline(iss,species.ref) )
+        panel->species.push_back(species);
+    if( ! panel->ReadSlots(ifs,header) ) {
+        std::cerr<<"ERROR : slots of panel \""<<file<<"\" are not built by this classify , exit ..."<<std::endl;
+        exit(1);
+    }
+    if( ! ifs ) {
+        std::cerr<<"ERROR : \""<<file<<"\" is truncated , exit ..."<<std::endl;
+        exit(1);
+    }
+    return panel ;
+}
+
+// written into file.tmp first , a failed update keeps the old panel.
+void save_panel(const std::string & file , Panel & panel){
+    PanelHeader & header = panel.header ;
+    std::string lines ;
+    for( const auto & species : panel.species )
+        lines += std::to_string(species.id) + '\t' + std::to_string(species.kmers) + '\t'
+            + std::to_string(species.generation) + '\t' + species.ref + '\n' ;
+    header.species_size = lines.size();
+    header.slot_size = panel.SlotSize();
+    header.slots = 0 ;
+    std::string tmp = file + ".tmp" ;
+    std::ofstream ofs(tmp,std::ios::binary);
+    ofs.write((const char *)&header,sizeof(header));
+    ofs.write(lines.data(),lines.size());
+    header.slots = panel.WriteSlots(ofs);
+    ofs.seekp(0);
+    ofs.write((const char *)&header,sizeof(header));
+    ofs.close();
+    if( ! ofs || rename(tmp.c_str(),file.c_str()) != 0 ) {
+        std::cerr<<"ERROR : failed to write panel file \""<<file<<"\" , exit ..."<<std::endl;
+        exit(1);
+    }
+    std::cerr<<"Saved "<<header.slots<<" "<<header.K<<"-mers of "<<panel.species.size()
+        <<" species into "<<file<<" , generation "<<header.generation<<std::endl;
 }
 
 void printUsage() {
     std::cerr<<"Uasge :\n\tclassify --hap hap0 --hap hap1 [... --hap hapn ] --read read1.fq [--read read2.fq] [--thread t_num]"<<std::endl;
+    std::cerr<<"\tclassify --index panel.idx --read read1.fq [--read read2.fq] [--thread t_num]"<<std::endl;
+    std::cerr<<"\t\t[--read1 r_1.fq --read2 r_2.fq] : a pair of files , mates read in lockstep and voted as one read"<<std::endl;
+    std::cerr<<"\t\t[--interleaved] : records 2i and 2i+1 of every --read file are mates"<<std::endl;
+    std::cerr<<"\t\t[--reader n] : read n files at the same time , default 4"<<std::endl;
+    std::cerr<<"\t\t[--bloom-fpr f] : test kmers by a bloom filter with false positive rate f before the table"<<std::endl;
+    std::cerr<<"\t\t[--bloom-size MB] : size the bloom filter by MB instead , default fpr is 0.01"<<std::endl;
+    std::cerr<<"\t\t[--split]    : then split each read file into <species>.<read> and homozygous.<read>"<<std::endl;
+    std::cerr<<"\t\t[--split-gz] : the same as --split , but write BGZF compressed <species>.<read>.gz"<<std::endl;
+    std::cerr<<"\t\t[--compact] [--fp-bits 16] : with --hap , use a minimal perfect hash index of about 3 bytes per kmer ,"<<std::endl;
+    std::cerr<<"\t\t                             a kmer not in index votes with 2^-fp_bits chance"<<std::endl;
+    std::cerr<<"\t\t[--early-margin m [--early-ratio r]] : stop looking up reads of a barcode once its best haplotype"<<std::endl;
+    std::cerr<<"\t\t                    leads the second by m votes and by r times , off by default ;"<<std::endl;
+    std::cerr<<"\t\t                    later reads of it are only counted as skipped , not in its haplotype counts ;"<<std::endl;
+    std::cerr<<"\t\t                    not with --kmer-shard , a kmer shard index or --sample-compare"<<std::endl;
+    std::cerr<<"\t\t[--sample stride:s|minimizer:w|mod:d] : only look up every s-th kmer , the minimizer of every w kmers ,"<<std::endl;
+    std::cerr<<"\t\t                    or kmers with hash 0 modulo d ( --hap loads only those kmers then )"<<std::endl;
+    std::cerr<<"\t\t[--sample-compare] : also vote every kmer and report how barcode calls change"<<std::endl;
+    std::cerr<<"\t\t[--kmer-shard i/n] : with --hap , only use kmers of hash shard i in n shards"<<std::endl;
+    std::cerr<<"\t\t[--read-shard i/n] : only classify reads of barcode shard i in n shards"<<std::endl;
+    std::cerr<<"\t\t[--partial out.bin] : save the binary partial result of a shard instead of printing"<<std::endl;
+    std::cerr<<"\t\t[--progress sec] : print progress every sec seconds , default 10 , 0 for none"<<std::endl;
+    std::cerr<<"\t\t[--stats out.json] : save stage times , thread counters and kmer hits as json"<<std::endl;
+    std::cerr<<"\tclassify build-index --hap hap0 --hap hap1 [... --hap hapn ] --index panel.idx [--compact] [--fp-bits 16] [--kmer-shard i/n] [--thread t_num]"<<std::endl;
+    std::cerr<<"\tclassify merge --partial shard0.bin --partial shard1.bin [... --partial shardn.bin ]"<<std::endl;
+    std::cerr<<"\t\tadd partial results and print the result like classify."<<std::endl;
+    std::cerr<<"\tclassify extract-unique --ref ref0.fa --ref ref1.fa [... --ref refn.fa ] [--mer 21] [--lower 1] [--upper 33] [--thread t_num] [--index panel.idx]"<<std::endl;
+    std::cerr<<"\t\twrite unique kmers of refi.fa into `basename refi.fa`.t2.unique.filter.mer , and into panel.idx if --index is set."<<std::endl;
+    std::cerr<<"\tclassify panel --panel panel.kpl [--add ref.fa ...] [--remove ref.fa ...] [--mer 21] [--lower 1] [--upper 33] [--thread t_num] [--index panel.idx]"<<std::endl;
+    std::cerr<<"\t\tadd or remove species of a persistent panel ( made by the first --add ) , only the added or removed references are counted ."<<std::endl;
+    std::cerr<<"\t\tunique kmer files of species whose unique kmers changed are written again , as extract-unique names them ."<<std::endl;
+    std::cerr<<"\t\t--mer , --lower and --upper are fixed when the panel is made ; --remove takes the reference path or its file name ."<<std::endl;
+    std::cerr<<"\tclassify --self-test"<<std::endl;
+    std::cerr<<"\t\trun the slower built in checks , as make test does ."<<std::endl;
     std::cerr<<"output format: \n\tbarcode haplotype(0/1/2.../n/-1) read_count_hap0 read_count_hap1 ...read_count_hapn read_count_hap-1"<<std::endl;
     std::cerr<<"notice : --read accept file in gzip format , but file must end by \".gz\""<<std::endl;
 }
 
 void TestAll(){
     assert(parseName("VSDSDS#XXX_xxx_s/1")=="XXX_xxx_s");
+    std::string h1("@V300017823L1C001R051096800#203_1533_1069/1");
+    barcode_t b1 = parseBarcode(h1.data(),h1.size());
+    assert(b1 < PACKED_BARCODE_NUM);
+    assert(barcodeName(b1) == "203_1533_1069");
+    // barcodes that do not pack are interned , which is checked by SelfTest
+    // on its own dict , g_barcode_dict is left empty here
+    barcode_t b2 ;
+    std::string h2("@V300017823L1C001R051096800#0_0");
+    Span s2 = barcodeSpan(h2.data(),h2.size());
+    assert(std::string(s2.data,s2.len) == "0_0" && ! packBarcode(s2.data,s2.len,b2));
+    std::string h3("@V300017823L1C001R051096800#1537_1_1/2");
+    Span s3 = barcodeSpan(h3.data(),h3.size());
+    assert(std::string(s3.data,s3.len) == "1537_1_1" && ! packBarcode(s3.data,s3.len,b2));
+    Arena arena(64);
+    const char * word = arena.Copy("ACGT",4);
+    assert(strcmp(word,"ACGT") == 0);
+    assert((uintptr_t)arena.Alloc(100,16) % 16 == 0);
+    assert(arena.Bytes() >= 164);
+    int shard , shards ;
+    assert(parseShard("1/4",shard,shards) && shard == 1 && shards == 4);
+    assert(! parseShard("4/4",shard,shards));
+    assert(barcodeName(parseBarcode(h1.data(),h1.size())) == "203_1533_1069");
     Kmer::InitFilter(5);
     auto str1=BaseStr::str2BaseStr("AGCTC");
     int  t1[] = { '\000','\003','\001','\002','\001'};
@@ -355,26 +2216,562 @@ void TestAll(){
     std::string k2 = BaseStr::BaseStr2Str(Kmer::ToBaseStr(kmers[1]));
     assert(k1 == "AGCTC");
     assert(k2 == "AGCTA");
+    typedef KmerTUtil<KmerT<5> > Util5;
+    std::vector<KmerT<5> > kmers5;
+    CanonicalKmerIterator<KmerT<5> > it5("GAGCTA",6);
+    for( KmerT<5> k5 ; it5.Next(k5) ; ) kmers5.push_back(k5);
+    assert(kmers5.size() == 2 );
+    assert(kmers5[0].low == 0xD9 );
+    assert(kmers5[1].low == 0xD8 );
+    assert(BaseStr::BaseStr2Str(Util5::ToBaseStr(kmers5[1])) == "AGCTA");
+    // kmers restart after N : GAGCT and AGCTA are the kmers of GAGCTA
+    CanonicalKmerIterator<KmerT<5> > itn("GAGCTNGAGCTAnGAGC",17);
+    std::vector<KmerT<5> > kmersn;
+    for( KmerT<5> k5 ; itn.Next(k5) ; ) kmersn.push_back(k5);
+    assert(kmersn.size() == 3 && itn.Count() == 3 );
+    assert(kmersn[0] == kmers5[0] && kmersn[1] == kmers5[0] && kmersn[2] == kmers5[1] );
+    KmerSampling sampling;
+    assert(sampling.Parse("minimizer:3") && ! sampling.Parse("window:3"));
+    std::string r20("ACGTTGCAAGGCTTACCGAT");
+    SampledKmerIterator<KmerT<5> > mit(r20.data(),r20.size(),sampling);
+    int minimizers = 0 ;
+    for( KmerT<5> k5 ; mit.Next(k5) ; ) minimizers ++ ;
+    // 16 kmers , at least one of every 3 is a minimizer
+    assert(minimizers >= 16 / 3 && minimizers <= 16 - 3 + 1 );
+    // two words kmer : canonical of a kmer and its reverse complement are the same
+    typedef KmerTUtil<KmerT<40> > Util40;
+    std::string r40("ACGTTGCAAGGCTTACCGATGCATGCCATGACTGAGCTAGCATCGA");
+    std::vector<KmerT<40> > kmers40;
+    CanonicalKmerIterator<KmerT<40> > it40(r40.data(),r40.size());
+    for( KmerT<40> k40 ; it40.Next(k40) ; ) kmers40.push_back(k40);
+    assert(kmers40.size() == r40.size() - 40 + 1 );
+    for( int i = 0 ; i < (int)kmers40.size() ; i ++ ) {
+        auto str = BaseStr::str2BaseStr(r40.substr(i,40));
+        auto rc = BaseStr::reverseComplementSeq(str);
+        assert(Util40::str2Kmer(str) == kmers40[i]);
+        assert(Util40::str2Kmer(rc) == kmers40[i]);
+        auto back = Util40::ToBaseStr(kmers40[i]);
+        assert(back == str || back == rc );
+    }
+    KmerHapTable<Kmer> table;
+    table.Insert(kmers[0],0);
+    table.Insert(kmers[1],1);
+    table.Insert(kmers[1],2);
+    assert(table.Find(kmers[0]) == 0 );
+    assert(table.Find(kmers[1]) == -1 );
+    assert(table.FindAt(kmers[0],table.Bucket(kmers[0])) == 0 );
+    assert(table.Find(Kmer::str2Kmer(BaseStr::str2BaseStr("AAAAA"))) == -1 );
+    assert(table.Erase(kmers[0]) == 0 );
+    assert(table.Find(kmers[0]) == -1 );
+    {
+        // panel owners while species 3 and 5 come and go
+        KmerPanelTable<uint64_t> panel ;
+        assert(panel.Add(7,3,true) == std::make_pair(-1,3));
+        assert(panel.Add(7,5,false) == std::make_pair(3,-1));
+        assert(panel.Remove(7,3,true) == std::make_pair(-1,-1));
+        assert(panel.Add(7,3,true) == std::make_pair(-1,-1));
+        assert(panel.Remove(7,5,false) == std::make_pair(-1,3));
+        assert(panel.Remove(7,3,true) == std::make_pair(3,-1));
+        assert(panel.Remove(7,3,true).first == -2 && panel.Remove(8,3,false).first == -2 );
+    }
+    // whole pairs in small blocks , and an exact record number
+    struct StringSource : public ByteSource {
+        std::string text ; size_t pos ;
+        StringSource(const std::string & t) : text(t) , pos(0) {}
+        size_t Read(char * buf , size_t n){
+            n = std::min(n,text.size() - pos);
+            memcpy(buf,text.data() + pos,n);
+            pos += n ;
+            return n ;
+        }
+    };
+    std::string fq ;
+    for( int i = 0 ; i < 6 ; i ++ ) fq += "@r" + std::to_string(i) + "#1_2_3\nACGT\n+\nIIII\n" ;
+    FastqChunkReader pairs(new StringSource(fq),40,2);
+    FastqChunk fc ;
+    int records = 0 ;
+    while( pairs.Next(fc) ) {
+        assert(fc.num % 2 == 0 );
+        records += fc.num ;
+    }
+    assert(records == 6 );
+    FastqChunkReader exact(new StringSource(fq),1024);
+    assert(exact.Next(fc,4) && fc.num == 4 && exact.Next(fc,4) && fc.num == 2 && ! exact.Next(fc,4));
+    assert(jsonString("a\"b\\c\n") == "\"a\\\"b\\\\c\\u000a\"");
+    ThreadCounters counters;
+    counters.Add(ThreadCounters::READS,2);
+    counters.Add(ThreadCounters::READS,3);
+    counters.Max(ThreadCounters::DEPTH_MAX,4);
+    counters.Max(ThreadCounters::DEPTH_MAX,1);
+    assert(counters.Get(ThreadCounters::READS) == 5 && counters.Get(ThreadCounters::DEPTH_MAX) == 4);
+}
+
+// checks too slow for every start , run by "classify --self-test" ( make test )
+void SelfTest(){
+    {
+        // interned ids survive table growth , the thread cache does not mix
+        // names nor dicts
+        BarcodeDict dict , other ;
+        std::vector<barcode_t> interned ;
+        for( int i = 0 ; i < 2000 ; i ++ ) {
+            std::string name = "x" + std::to_string(i);
+            interned.push_back(dict.Intern(name.data(),name.size()));
+        }
+        for( int i = 0 ; i < 2000 ; i ++ ) {
+            std::string name = "x" + std::to_string(i);
+            assert(dict.Intern(name.data(),name.size()) == interned[i]);
+            assert(dict.Name(interned[i]) == name);
+        }
+        barcode_t b2 = dict.Intern("0_0",3);
+        assert(b2 >= PACKED_BARCODE_NUM && dict.Name(b2) == "0_0");
+        assert(other.Intern("0_0",3) == PACKED_BARCODE_NUM && dict.Intern("0_0",3) == b2);
+        // nor a dict made again at the same address
+        for( int round = 0 ; round < 2 ; round ++ ) {
+            BarcodeDict again ;
+            if( round == 0 ) again.Intern("y",1);
+            assert(again.Intern("z",1) == PACKED_BARCODE_NUM + 1 - round);
+        }
+    }
+    {
+        // partitioned inserts give the same content as Insert
+        KmerHapTable<uint64_t> serial , parallel ;
+        PartitionedInserter<KmerHapTable<uint64_t> > inserter(parallel,100000);
+        std::vector<std::thread> threads;
+        for( int t = 0 ; t < 4 ; t ++ ) {
+            threads.push_back(std::thread([&inserter,t](){
+                PartitionedInserter<KmerHapTable<uint64_t> >::Batch batch(inserter);
+                for( uint64_t i = t ; i < 200000 ; i += 4 )
+                    batch.Add(i % 150000,KmerHapTable<uint64_t>::HashOf(i % 150000),i % 3);
+            }));
+        }
+        for( auto & t : threads ) t.join();
+        inserter.Finish();
+        for( uint64_t i = 0 ; i < 200000 ; i ++ ) serial.Insert(i % 150000,i % 3);
+        assert(parallel.Size() == serial.Size() && parallel.Shared() == serial.Shared());
+        for( uint64_t i = 0 ; i < 150000 ; i ++ ) assert(parallel.Find(i) == serial.Find(i));
+        // and the same bytes once both are in canonical order
+        serial.Canonical();
+        assert(parallel.Capacity() == serial.Capacity()
+                && memcmp(parallel.slots,serial.slots,serial.Capacity() * sizeof(serial.slots[0])) == 0);
+    }
+    BlockedBloomFilter bloom;
+    bloom.Init(100,0.01,0);
+    for( uint64_t i = 0 ; i < 100 ; i ++ ) bloom.Insert(mixHash64(i));
+    for( uint64_t i = 0 ; i < 100 ; i ++ ) assert(bloom.Test(mixHash64(i)));
+    std::vector<std::pair<uint64_t,uint16_t> > entries;
+    for( uint64_t i = 0 ; i < 1000 ; i ++ ) entries.push_back(std::make_pair(mixHash64(i),i%3));
+    CompactHapTable compact;
+    compact.Build(entries,16,3);
+    for( const auto & e : entries ) assert(compact.Find(e.first) == e.second);
+    std::cerr<<"self test passed"<<std::endl;
 }
 
 //
 // Main function
 //
 
+// classify build-index : load haplotype kmers once and save them into a binary index file.
+int mainBuildIndex(int argc , char ** argv){
+    static struct option long_options[] = {
+        {"hap",  required_argument,  NULL, 'k'},
+        {"index",required_argument,  NULL, 'i'},
+        {"compact",no_argument,      NULL, 'c'},
+        {"fp-bits",required_argument,NULL, 'p'},
+        {"kmer-shard",required_argument,NULL,'K'},
+        {"thread",required_argument, NULL, 't'},
+        {"help",  no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    static char optstring[] = "k:i:cp:K:t:h";
+    std::vector<std::string> haps;
+    std::string index;
+    bool compact = false ;
+    int fp_bits = 16 ;
+    int t_num = 1 ;
+    while(1){
+        int c = getopt_long(argc, argv, optstring, long_options, NULL);
+        if (c<0) break;
+        switch (c){
+            case 'k':
+                haps.push_back(std::string(optarg));
+                break;
+            case 'i':
+                index = std::string(optarg);
+                break;
+            case 'c':
+                compact = true ;
+                break;
+            case 'p':
+                fp_bits = atoi(optarg);
+                break;
+            case 'K':
+                if( ! parseShard(optarg,g_kmer_shard,g_kmer_shards) ) {
+                    printUsage();
+                    return -1;
+                }
+                break;
+            case 't':
+                t_num = atoi(optarg);
+                break;
+            case 'h':
+            default :
+                printUsage();
+                return -1;
+        }
+    }
+    if( haps.size() < 2 || index.empty() || fp_bits < 0 || fp_bits > 32 || t_num < 1 ) {
+        printUsage();
+        return -1;
+    }
+    std::cerr<<"__START__"<<std::endl;
+    logtime();
+    load_kmers(haps,t_num);
+    if( g_kmers->Shared() > 0 )
+        std::cerr<<" INFO : ignore "<<g_kmers->Shared()<<" kmers shared by more than one haplotype"<<std::endl;
+    InitAdaptor();
+    if( compact )
+        compact_index(fp_bits);
+    save_index(index,haps);
+    logtime();
+    std::cerr<<"__END__"<<std::endl;
+    return 0;
+}
+
+// classify extract-unique : count references and extract species unique kmers.
+int mainExtractUnique(int argc , char ** argv){
+    static struct option long_options[] = {
+        {"ref",   required_argument, NULL, 'f'},
+        {"mer",   required_argument, NULL, 'm'},
+        {"lower", required_argument, NULL, 'l'},
+        {"upper", required_argument, NULL, 'u'},
+        {"thread",required_argument, NULL, 't'},
+        {"index", required_argument, NULL, 'i'},
+        {"help",  no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    static char optstring[] = "f:m:l:u:t:i:h";
+    std::vector<std::string> refs;
+    std::string index;
+    int mer = 21 , lower = 1 , upper = 33 , t_num = 1 ;
+    while(1){
+        int c = getopt_long(argc, argv, optstring, long_options, NULL);
+        if (c<0) break;
+        switch (c){
+            case 'f':
+                refs.push_back(std::string(optarg));
+                break;
+            case 'm':
+                mer = atoi(optarg);
+                break;
+            case 'l':
+                lower = atoi(optarg);
+                break;
+            case 'u':
+                upper = atoi(optarg);
+                break;
+            case 't':
+                t_num = atoi(optarg);
+                break;
+            case 'i':
+                index = std::string(optarg);
+                break;
+            case 'h':
+            default :
+                printUsage();
+                return -1;
+        }
+    }
+    if( refs.size() < 2 || refs.size() > KmerSpeciesTable<Kmer>::MAX_SPECIES
+            || lower < 1 || upper < lower || t_num < 1 ) {
+        printUsage();
+        return -1;
+    }
+    UniqueExtractor * extractor = KDispatch<KmerUniqueExtractor,UniqueExtractor,MAX_K>::Create(mer);
+    if( extractor == NULL ) {
+        std::cerr<<"ERROR : kmer size "<<mer<<" is not in ["<<MIN_K<<","<<MAX_K<<"] , exit ..."<<std::endl;
+        return -1;
+    }
+    std::vector<std::string> outs;
+    for( const auto & ref : refs )
+        outs.push_back(ref.substr(ref.find_last_of('/')+1) + ".t2.unique.filter.mer");
+    std::cerr<<"__START__"<<std::endl;
+    logtime();
+    extractor->Run(refs,outs,lower,upper,t_num,index);
+    logtime();
+    std::cerr<<"__END__"<<std::endl;
+    return 0;
+}
+
+// classify panel : add or remove species of a persistent panel , then write
+// the unique kmer files that changed .
+int mainPanel(int argc , char ** argv){
+    static struct option long_options[] = {
+        {"panel", required_argument, NULL, 'P'},
+        {"add",   required_argument, NULL, 'a'},
+        {"remove",required_argument, NULL, 'd'},
+        {"mer",   required_argument, NULL, 'm'},
+        {"lower", required_argument, NULL, 'l'},
+        {"upper", required_argument, NULL, 'u'},
+        {"thread",required_argument, NULL, 't'},
+        {"index", required_argument, NULL, 'i'},
+        {"help",  no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    static char optstring[] = "P:a:d:m:l:u:t:i:h";
+    std::string file , index ;
+    std::vector<std::string> adds , removes ;
+    // 0 : the value of the panel , or the default of a new panel
+    int mer = 0 , lower = 0 , upper = 0 , t_num = 1 ;
+    while(1){
+        int c = getopt_long(argc, argv, optstring, long_options, NULL);
+        if (c<0) break;
+        switch (c){
+            case 'P':
+                file = std::string(optarg);
+                break;
+            case 'a':
+                adds.push_back(std::string(optarg));
+                break;
+            case 'd':
+                removes.push_back(std::string(optarg));
+                break;
+            case 'm':
+                mer = atoi(optarg);
+                break;
+            case 'l':
+                lower = atoi(optarg);
+                break;
+            case 'u':
+                upper = atoi(optarg);
+                break;
+            case 't':
+                t_num = atoi(optarg);
+                break;
+            case 'i':
+                index = std::string(optarg);
+                break;
+            case 'h':
+            default :
+                printUsage();
+                return -1;
+        }
+    }
+    if( file.empty() || mer < 0 || lower < 0 || upper < 0 || t_num < 1 ) {
+        printUsage();
+        return -1;
+    }
+    std::cerr<<"__START__"<<std::endl;
+    logtime();
+    Panel * panel = NULL ;
+    struct stat st ;
+    if( stat(file.c_str(),&st) == 0 ) {
+        std::cerr<<"__load panel "<<file<<std::endl;
+        panel = load_panel(file);
+        const PanelHeader & header = panel->header ;
+        if( ( mer > 0 && mer != (int)header.K ) || ( lower > 0 && lower != (int)header.lower )
+                || ( upper > 0 && upper != (int)header.upper ) ) {
+            std::cerr<<"ERROR : panel \""<<file<<"\" is made with --mer "<<header.K<<" --lower "<<header.lower
+                <<" --upper "<<header.upper<<" , exit ..."<<std::endl;
+            return 1;
+        }
+        logtime();
+    } else {
+        mer = mer > 0 ? mer : 21 ;
+        lower = lower > 0 ? lower : 1 ;
+        upper = upper > 0 ? upper : 33 ;
+        if( upper < lower ) {
+            printUsage();
+            return -1;
+        }
+        panel = KDispatch<KmerPanel,Panel,MAX_K>::Create(mer);
+        if( panel == NULL ) {
+            std::cerr<<"ERROR : kmer size "<<mer<<" is not in ["<<MIN_K<<","<<MAX_K<<"] , exit ..."<<std::endl;
+            return -1;
+        }
+        PanelHeader & header = panel->header ;
+        memset(&header,0,sizeof(header));
+        memcpy(header.magic,PANEL_MAGIC,sizeof(PANEL_MAGIC));
+        header.version = PANEL_VERSION ;
+        header.K = mer ;
+        header.lower = lower ;
+        header.upper = upper ;
+    }
+    PanelHeader & header = panel->header ;
+    bool update = ! adds.empty() || ! removes.empty() ;
+    if( update ) header.generation ++ ;
+    // removed species first , so a reference can be removed and added again
+    std::vector<std::string> refs ;
+    std::vector<int> ids ;
+    std::vector<long> expect ;
+    for( const auto & name : removes ) {
+        auto it = panel->species.begin();
+        for( ; it != panel->species.end() ; ++ it )
+            if( it->ref == name || it->ref.substr(it->ref.find_last_of('/')+1) == name ) break;
+        if( it == panel->species.end() ) {
+            std::cerr<<"ERROR : \""<<name<<"\" is not in panel \""<<file<<"\" , exit ..."<<std::endl;
+            return 1;
+        }
+        refs.push_back(it->ref);
+        ids.push_back(it->id);
+        expect.push_back(it->kmers);
+        std::cerr<<" INFO : remove species "<<it->id<<" "<<it->ref<<std::endl;
+        panel->species.erase(it);
+    }
+    std::vector<char> changed(header.next_id + adds.size(),0);
+    if( ! refs.empty() )
+        panel->Update(refs,ids,expect,true,t_num,changed);
+    refs.clear() ; ids.clear() ;
+    for( const auto & ref : adds ) {
+        for( const auto & species : panel->species ) {
+            if( species.Out() == PanelSpecies{0,0,0,ref}.Out() ) {
+                std::cerr<<"ERROR : \""<<ref<<"\" is in panel \""<<file<<"\" as "<<species.ref<<" already , exit ..."<<std::endl;
+                return 1;
+            }
+        }
+        if( header.next_id > KmerPanelTable<Kmer>::MAX_SPECIES ) {
+            std::cerr<<"ERROR : panel \""<<file<<"\" has no species id left , exit ..."<<std::endl;
+            return 1;
+        }
+        PanelSpecies species ;
+        species.id = header.next_id ++ ;
+        species.kmers = 0 ;
+        species.generation = header.generation ;
+        species.ref = ref ;
+        panel->species.push_back(species);
+        refs.push_back(ref);
+        ids.push_back(species.id);
+        changed[species.id] = 1 ;
+    }
+    if( ! refs.empty() ) {
+        std::vector<long> kmers = panel->Update(refs,ids,std::vector<long>(refs.size(),0),false,t_num,changed);
+        for( size_t i = 0 ; i < refs.size() ; i ++ )
+            panel->species[panel->species.size() - refs.size() + i].kmers = kmers[i];
+    }
+    if( update ) {
+        logtime();
+        save_panel(file,*panel);
+        logtime();
+        panel->WriteUnique(changed,t_num);
+    }
+    for( const auto & species : panel->species )
+        std::cerr<<" INFO : species "<<species.id<<" "<<species.ref<<" , "<<species.kmers
+            <<" kmers , added in generation "<<species.generation
+            <<( changed[species.id] ? " , unique kmers changed" : "" )<<std::endl;
+    logtime();
+    if( ! index.empty() ) {
+        if( panel->species.size() < 2 ) {
+            std::cerr<<"ERROR : an index needs at least 2 species , exit ..."<<std::endl;
+            return 1;
+        }
+        panel->BuildIndex(t_num);
+        std::vector<std::string> outs ;
+        for( const auto & species : panel->species ) outs.push_back(species.Out());
+        save_index(index,outs);
+        logtime();
+    }
+    std::cerr<<"__END__"<<std::endl;
+    return 0;
+}
+
+// classify merge : add partial results of shards and print the final result.
+int mainMerge(int argc , char ** argv){
+    static struct option long_options[] = {
+        {"partial",required_argument,NULL, 'P'},
+        {"help",  no_argument,       NULL, 'h'},
+        {0, 0, 0, 0}
+    };
+    static char optstring[] = "P:h";
+    std::vector<std::string> partials;
+    while(1){
+        int c = getopt_long(argc, argv, optstring, long_options, NULL);
+        if (c<0) break;
+        switch (c){
+            case 'P':
+                partials.push_back(std::string(optarg));
+                break;
+            case 'h':
+            default :
+                printUsage();
+                return -1;
+        }
+    }
+    if( partials.empty() ) {
+        printUsage();
+        return -1;
+    }
+    std::cerr<<"__START__"<<std::endl;
+    logtime();
+    BarcodeCache * data = NULL ;
+    std::vector<std::string> haps;
+    for( const auto & partial : partials )
+        load_partial(partial,data,haps);
+    logtime();
+    std::cerr<<"__print result__"<<std::endl;
+    printBarcodeInfos(*data,haps);
+    std::cout.flush();
+    logtime();
+    std::cerr<<"__END__"<<std::endl;
+    return 0;
+}
+
+// bench/bench.cpp builds this file in with its own main
+#ifndef CLASSIFY_NO_MAIN
 int main(int argc ,char ** argv ){
     TestAll();
+    if( argc > 1 && std::string(argv[1]) == "--self-test" ) {
+        SelfTest();
+        fastExit(0);
+    }
+    if( argc > 1 && std::string(argv[1]) == "build-index" )
+        fastExit(mainBuildIndex(argc-1,argv+1));
+    if( argc > 1 && std::string(argv[1]) == "extract-unique" )
+        fastExit(mainExtractUnique(argc-1,argv+1));
+    if( argc > 1 && std::string(argv[1]) == "merge" )
+        fastExit(mainMerge(argc-1,argv+1));
+    if( argc > 1 && std::string(argv[1]) == "panel" )
+        fastExit(mainPanel(argc-1,argv+1));
     static struct option long_options[] = {
         {"hap",  required_argument,  NULL, 'k'},
+        {"index",required_argument,  NULL, 'i'},
         {"read", required_argument,  NULL, 'r'},
+        {"read1",required_argument,  NULL, '1'},
+        {"read2",required_argument,  NULL, '2'},
+        {"interleaved",no_argument,  NULL, 'I'},
         {"thread",required_argument, NULL, 't'},
+        {"reader",required_argument, NULL, 'n'},
+        {"bloom-fpr",required_argument,NULL,'f'},
+        {"bloom-size",required_argument,NULL,'b'},
+        {"compact",no_argument,      NULL, 'c'},
+        {"fp-bits",required_argument,NULL, 'p'},
+        {"split", no_argument,       NULL, 's'},
+        {"split-gz",no_argument,     NULL, 'z'},
+        {"kmer-shard",required_argument,NULL,'K'},
+        {"read-shard",required_argument,NULL,'R'},
+        {"partial",required_argument,NULL, 'P'},
+        {"early-margin",required_argument,NULL,'m'},
+        {"early-ratio",required_argument,NULL,'e'},
+        {"sample",required_argument, NULL, 'S'},
+        {"sample-compare",no_argument,NULL,'C'},
+        {"progress",required_argument,NULL,'g'},
+        {"stats",required_argument,  NULL, 'j'},
         {"help",  no_argument,       NULL, 'h'},
         {0, 0, 0, 0}
     };
-    static char optstring[] = "k:l:r:t:h";
+    static char optstring[] = "k:i:l:r:1:2:It:n:f:b:cp:szK:R:P:m:e:S:Cg:j:h";
     std::string hap0 , hap1 ;
     std::vector<std::string> haps;
-    std::vector<std::string> read;
+    std::vector<std::string> read , read1 , read2 ;
+    bool interleaved = false ;
+    std::string index;
     int t_num=1;
+    int r_num=4;
+    double bloom_fpr = 0 , bloom_mb = 0 ;
+    bool compact = false ;
+    int fp_bits = 16 ;
+    bool split = false , split_gz = false ;
+    bool bad_option = false ;
+    std::string partial ;
+    std::string stats_file ;
     while(1){
         int c = getopt_long(argc, argv, optstring, long_options, NULL);
         if (c<0) break;
@@ -382,39 +2779,168 @@ int main(int argc ,char ** argv ){
             case 'k':
                 haps.push_back(std::string(optarg));
                 break;
+            case 'i':
+                index = std::string(optarg);
+                break;
+            case 's':
+                split = true ;
+                break;
+            case 'z':
+                split = true ;
+                split_gz = true ;
+                break;
             case 'r':
                 read.push_back(std::string(optarg));
                 break;
+            case '1':
+                read1.push_back(std::string(optarg));
+                break;
+            case '2':
+                read2.push_back(std::string(optarg));
+                break;
+            case 'I':
+                interleaved = true ;
+                break;
             case 't':
                 t_num = atoi(optarg);
                 break;
+            case 'n':
+                r_num = atoi(optarg);
+                break;
+            case 'f':
+                bloom_fpr = atof(optarg);
+                break;
+            case 'b':
+                bloom_mb = atof(optarg);
+                break;
+            case 'c':
+                compact = true ;
+                break;
+            case 'p':
+                fp_bits = atoi(optarg);
+                break;
+            case 'K':
+                bad_option |= ! parseShard(optarg,g_kmer_shard,g_kmer_shards);
+                break;
+            case 'R':
+                bad_option |= ! parseShard(optarg,g_read_shard,g_read_shards);
+                break;
+            case 'P':
+                partial = std::string(optarg);
+                break;
+            case 'm':
+                g_early_margin = atoi(optarg);
+                break;
+            case 'e':
+                g_early_ratio = atof(optarg);
+                break;
+            case 'S':
+                bad_option |= ! g_sampling.Parse(optarg);
+                break;
+            case 'C':
+                g_sample_compare = true ;
+                break;
+            case 'g':
+                g_progress = atof(optarg);
+                break;
+            case 'j':
+                stats_file = std::string(optarg);
+                break;
             case 'h':
             default :
                 printUsage();
                 return -1;
         }
     }
-    if( haps.size() < 2 || read.empty() || t_num< 1) {
+    // the kmer shard of an index is recorded in it
+    if( ( haps.size() < 2 && index.empty() ) || ( !haps.empty() && !index.empty() )
+            || ( read.empty() && read1.empty() ) || read1.size() != read2.size()
+            || t_num< 1 || r_num < 1
+            || bloom_fpr < 0 || bloom_fpr >= 1 || bloom_mb < 0
+            || fp_bits < 0 || fp_bits > 32
+            || bad_option || ( g_kmer_shards > 1 && ! index.empty() )
+            || ( split && ! partial.empty() )
+            || g_early_margin < 0 || g_early_ratio < 0 || g_progress < 0
+            || ( g_early_ratio > 0 && g_early_margin == 0 )
+            // a kmer shard would decide on its part of the votes , and skip
+            // reads other shards need ; skipped reads have no exact votes
+            || ( g_early_margin > 0 && ( g_kmer_shards > 1 || g_sample_compare ) ) ) {
         printUsage();
         return -1;
     }
     std::cerr<<"__START__"<<std::endl;
     logtime();
-    for( int i = 0 ; i < (int)haps.size() ; i++ ) {
-        std::cerr<<"__load hap "<<i<<" kmers from file "<<haps[i]<<std::endl;
-        load_kmers(haps[i],i);
+    if( ! index.empty() ) {
+        std::cerr<<"__map index "<<index<<std::endl;
+        map_index(index,haps);
+        if( g_early_margin > 0 && g_kmer_shards > 1 ) {
+            std::cerr<<"ERROR : --early-margin does not work with the kmer shard index \""<<index<<"\" , exit ..."<<std::endl;
+            return 1;
+        }
+    } else {
+        load_kmers(haps,t_num);
+        if( g_kmers->Shared() > 0 )
+            std::cerr<<" INFO : ignore "<<g_kmers->Shared()<<" kmers shared by more than one haplotype"<<std::endl;
+        g_stages.Mark("load");
+        InitAdaptor();
+        g_stages.Mark("adaptor");
+        if( compact ) {
+            compact_index(fp_bits);
+            g_stages.Mark("compact");
+        }
     }
-    InitAdaptor();
+    if( ! index.empty() )
+        g_stages.Mark("load");
     logtime();
-    BarcodeCache data;
-    for(const auto r : read ){
-        std::cerr<<"__process read: "<<r<<std::endl;
-        processFastq(r,t_num,data);
+    if( bloom_fpr > 0 || bloom_mb > 0 ) {
+        int hashes ;
+        size_t bytes = g_kmers->BuildFilter(bloom_fpr > 0 ? bloom_fpr : 0.01 , (size_t)( bloom_mb * 1024 * 1024 ) , hashes);
+        if( bytes == 0 )
+            std::cerr<<" INFO : compact index has no bloom filter , ignore --bloom-*"<<std::endl;
+        else
+            std::cerr<<" INFO : bloom filter of "<<bytes<<" bytes with "<<hashes<<" hashes"<<std::endl;
+        g_stages.Mark("bloom");
         logtime();
-        std::cerr<<"__process read done__"<<std::endl;
     }
-    std::cerr<<"__print result__"<<std::endl;
-    printBarcodeInfos(data,haps);
+    if( g_early_margin > 0 )
+        g_early = new EarlyDecision();
+    BarcodeCache data;
+    VoteStats stats;
+    BarcodeCache * exact = g_sample_compare ? new BarcodeCache() : NULL ;
+    std::vector<ReadInput> inputs;
+    for( const auto & r : read ) inputs.push_back(ReadInput(r,"",interleaved));
+    for( size_t i = 0 ; i < read1.size() ; i ++ ) inputs.push_back(ReadInput(read1[i],read2[i],false));
+    if( ! processFastqs(inputs,t_num,r_num,data,stats,exact) )
+        fastExit(1);
+    printVoteStats(stats,bloom_fpr > 0 || bloom_mb > 0);
+    if( exact != NULL )
+        printSampleCompare(data,*exact,stats);
     logtime();
+    if( ! partial.empty() ) {
+        std::cerr<<"__save partial result__"<<std::endl;
+        save_partial(partial,data,haps);
+    } else {
+        std::cerr<<"__print result__"<<std::endl;
+        printBarcodeInfos(data,haps);
+        std::cout.flush();
+    }
+    g_stages.Mark("output");
+    logtime();
+    if( split ) {
+        ReadSplitter splitter(data,haps,split_gz,t_num);
+        read.insert(read.end(),read1.begin(),read1.end());
+        read.insert(read.end(),read2.begin(),read2.end());
+        for(const auto & r : read ){
+            std::cerr<<"__split read: "<<r<<std::endl;
+            splitter.Split(r);
+            logtime();
+        }
+        g_stages.Mark("split");
+    }
+    printTelemetry(data,stats,haps);
+    if( ! stats_file.empty() )
+        saveStats(stats_file,data,stats,haps);
     std::cerr<<"__END__"<<std::endl;
+    fastExit(0);
 }
+#endif
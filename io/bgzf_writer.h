@@ -0,0 +1,179 @@
+#ifndef IO_BGZF_WRITER_H
+#define IO_BGZF_WRITER_H
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+#include "../thread/mpmc_queue.h"
+
+//
+// BGZF output :
+//   data is cut into blocks of at most BLOCK bytes , each block is a gzip
+//   member with the 'BC' extra field , so the file is a normal gzip file and
+//   can be inflated in parallel by ParallelGzSource .
+//   batches of blocks are compressed by a pool shared by all writers , and
+//   every writer puts its batches into the file in submit order .
+//
+class BgzfWriter;
+
+class BgzfCompressPool {
+    public:
+        struct Task {
+            BgzfWriter * writer ;
+            long seq ;
+            std::string in ;
+            std::string out ;
+        };
+        explicit BgzfCompressPool(int threads , int level = 6)
+            : tasks(threads*4) , compress_level(level) {
+            for( int i = 0 ; i < threads ; i ++ )
+                workers.push_back(std::thread([this](){ Work(); }));
+        }
+        ~BgzfCompressPool(){
+            tasks.Close();
+            for( auto & t : workers ) t.join();
+        }
+        void Submit(Task * task) { tasks.Push(task); }
+
+    private:
+        void Work();
+        MPMCQueue<Task*> tasks;
+        std::vector<std::thread> workers;
+        int compress_level ;
+};
+
+class BgzfWriter {
+    public:
+        static const size_t BLOCK = 0xff00 ;
+        static const size_t BATCH = BLOCK * 16 ;
+
+        BgzfWriter(const std::string & file , BgzfCompressPool * p)
+            : name(file) , pool(p) , next_submit(0) , next_write(0) {
+            fp = fopen(file.c_str(),"wb");
+            if( fp == NULL ) Fail("failed to open");
+        }
+        ~BgzfWriter() { if( fp != NULL ) Close(); }
+
+        // not thread safe , one producer per writer.
+        void Write(const char * data , size_t len){
+            buffer.append(data,len);
+            if( buffer.size() >= BATCH ) Submit();
+        }
+
+        // flush , wait all batches written and put the BGZF EOF block.
+        void Close(){
+            if( ! buffer.empty() ) Submit();
+            std::unique_lock<std::mutex> guard(lock);
+            while( next_write < next_submit ) cv.wait(guard);
+            std::string eof;
+            AppendBlock(eof,NULL,0,6,NULL);
+            fwrite(eof.data(),1,eof.size(),fp);
+            if( fclose(fp) != 0 ) Fail("failed to write");
+            fp = NULL ;
+        }
+
+        // compress in into BGZF blocks appended to out
+        static void AppendBlock(std::string & out , const char * in , size_t len ,
+                int level , z_stream * z){
+            z_stream local;
+            if( z == NULL ) {
+                memset(&local,0,sizeof(local));
+                deflateInit2(&local,level,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY);
+                z = &local ;
+            } else
+                deflateReset(z);
+            static const unsigned char header[18] = {
+                0x1f,0x8b,8,4, 0,0,0,0, 0,0xff, 6,0, 'B','C', 2,0, 0,0 };
+            size_t start = out.size();
+            size_t bound = deflateBound(z,len);
+            out.resize(start + 18 + bound + 8);
+            unsigned char * p = (unsigned char *)&out[start];
+            memcpy(p,header,18);
+            unsigned char dummy ;
+            z->next_in = len > 0 ? (Bytef*)in : &dummy ;
+            z->avail_in = len ;
+            z->next_out = p + 18 ;
+            z->avail_out = bound ;
+            if( deflate(z,Z_FINISH) != Z_STREAM_END ) {
+                std::cerr<<"ERROR : deflate failed , exit ..."<<std::endl;
+                exit(1);
+            }
+            size_t comp = bound - z->avail_out ;
+            size_t bsize = 18 + comp + 8 - 1 ;
+            p[16] = bsize & 0xff ;
+            p[17] = ( bsize >> 8 ) & 0xff ;
+            uint32_t crc = crc32(0,len > 0 ? (const Bytef*)in : Z_NULL,len);
+            unsigned char * tail = p + 18 + comp ;
+            for( int i = 0 ; i < 4 ; i ++ ) tail[i] = ( crc >> ( 8 * i ) ) & 0xff ;
+            for( int i = 0 ; i < 4 ; i ++ ) tail[4+i] = ( len >> ( 8 * i ) ) & 0xff ;
+            out.resize(start + 18 + comp + 8);
+            if( z == &local ) deflateEnd(&local);
+        }
+
+        // called by pool threads , write every batch that is next in order.
+        void Done(BgzfCompressPool::Task * task){
+            std::lock_guard<std::mutex> guard(lock);
+            done[task->seq] = task ;
+            while( ! done.empty() && done.begin()->first == next_write ) {
+                BgzfCompressPool::Task * t = done.begin()->second ;
+                if( fwrite(t->out.data(),1,t->out.size(),fp) != t->out.size() )
+                    Fail("failed to write");
+                done.erase(done.begin());
+                delete t ;
+                next_write ++ ;
+            }
+            cv.notify_all();
+        }
+
+    private:
+        void Submit(){
+            BgzfCompressPool::Task * task = new BgzfCompressPool::Task();
+            task->writer = this ;
+            task->seq = next_submit ;
+            task->in.swap(buffer);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                next_submit ++ ;
+            }
+            pool->Submit(task);
+        }
+        void Fail(const char * what){
+            std::cerr<<"ERROR : "<<what<<" \""<<name<<"\" , exit ..."<<std::endl;
+            exit(1);
+        }
+
+        std::string name;
+        FILE * fp ;
+        BgzfCompressPool * pool ;
+        std::string buffer ;
+        long next_submit ;
+        long next_write ;
+        std::map<long,BgzfCompressPool::Task*> done;
+        std::mutex lock;
+        std::condition_variable cv;
+};
+
+inline void BgzfCompressPool::Work(){
+    z_stream z;
+    memset(&z,0,sizeof(z));
+    deflateInit2(&z,compress_level,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY);
+    Task * task ;
+    while( tasks.Pop(task) ) {
+        task->out.clear();
+        for( size_t s = 0 ; s < task->in.size() ; s += BgzfWriter::BLOCK ) {
+            size_t len = std::min((size_t)BgzfWriter::BLOCK , task->in.size() - s);
+            BgzfWriter::AppendBlock(task->out,task->in.data() + s,len,compress_level,&z);
+        }
+        task->writer->Done(task);
+    }
+    deflateEnd(&z);
+}
+#endif
@@ -0,0 +1,131 @@
+#ifndef IO_FASTQ_CHUNK_H
+#define IO_FASTQ_CHUNK_H
+#include <vector>
+#include <cstring>
+#include "gz_source.h"
+
+//
+// zero copy fastq parser :
+//   a large block of bytes is read at once and cut at the last whole
+//   record , records are spans pointing into the block . quality lines are
+//   skipped , the bytes of a broken record at block end are moved into the
+//   next block .
+//   for paired reads a chunk can be asked for an exact record number ( the
+//   records of the mate file ) , or to hold whole groups of records only
+//   ( interleaved pairs ) .
+//
+
+// string_view style span into a block.
+struct Span {
+    const char * data ;
+    int len ;
+};
+
+struct FastqRecord {
+    Span head ;
+    Span seq ;
+    Span raw ;   // whole record , with its last '\n' if any
+};
+
+struct FastqChunk {
+    std::vector<char> data ;          // block bytes , capacity is reused
+    size_t size ;                     // valid bytes in data
+    std::vector<FastqRecord> records ;
+    int num ;                         // valid records
+    FastqChunk() : size(0) , num(0) {}
+};
+
+class FastqChunkReader {
+    public:
+        // source is owned by the reader.
+        // group : a chunk only holds whole groups of group records , but the
+        //         last chunk of a file may end with a broken group .
+        FastqChunkReader(ByteSource * s , size_t block = 2 << 20 , int group = 1)
+            : source(s) , block_size(block) , group_size(group) , eof(false) {}
+        ~FastqChunkReader() { delete source ; }
+
+        // fill chunk with the next whole records.
+        // records : if > 0 , exactly records records unless the file ends .
+        // @return : false if there is no record any more.
+        bool Next(FastqChunk & chunk , int records = 0){
+            size_t want = block_size ;
+            while( true ) {
+                chunk.num = 0 ;
+                if( chunk.data.size() < carry.size() + want )
+                    chunk.data.resize(carry.size() + want);
+                memcpy(chunk.data.data(),carry.data(),carry.size());
+                chunk.size = carry.size();
+                while( ! eof && chunk.size < chunk.data.size() ) {
+                    size_t n = source->Read(chunk.data.data() + chunk.size , chunk.data.size() - chunk.size);
+                    if( n == 0 ) eof = true ;
+                    chunk.size += n ;
+                }
+                size_t used = Parse(chunk,records);
+                if( ( chunk.num > 0 && ( records == 0 || chunk.num == records ) ) || eof ) {
+                    carry.assign(chunk.data.data() + used , chunk.data.data() + chunk.size);
+                    return chunk.num > 0 ;
+                }
+                // a record longer than the block , or too few records , read more.
+                carry.assign(chunk.data.data() , chunk.data.data() + chunk.size);
+                want *= 2 ;
+            }
+        }
+
+    private:
+        // @return : end of line starting at p , or NULL if no newline before end.
+        static const char * lineEnd(const char * p , const char * end){
+            return (const char *)memchr(p,'\n',end - p);
+        }
+        static Span makeSpan(const char * b , const char * e){
+            if( e > b && *(e-1) == '\r' ) e -- ;
+            Span span ;
+            span.data = b ;
+            span.len = e - b ;
+            return span ;
+        }
+        // cut whole records , at most max if max > 0 ,
+        // at end of file the last line may miss '\n' .
+        // @return : bytes used by whole records.
+        size_t Parse(FastqChunk & chunk , int max){
+            const char * begin = chunk.data.data();
+            const char * end = begin + chunk.size ;
+            const char * p = begin ;
+            while( p < end && ( max <= 0 || chunk.num < max ) ) {
+                const char * e[4];
+                const char * q = p ;
+                int lines = 0 ;
+                for( ; lines < 4 && q < end ; lines ++ ) {
+                    e[lines] = lineEnd(q,end);
+                    if( e[lines] == NULL ) {
+                        if( ! eof ) break;
+                        e[lines] = end ;
+                    }
+                    q = e[lines] + 1 ;
+                }
+                // at end of file accept a record without its quality lines.
+                if( lines < 4 && ! ( eof && lines >= 2 ) ) break;
+                if( chunk.num >= (int)chunk.records.size() )
+                    chunk.records.resize(chunk.records.size() * 2 + 1024);
+                FastqRecord & record = chunk.records[chunk.num++];
+                record.head = makeSpan(p,e[0]);
+                record.seq = makeSpan(e[0]+1,e[1]);
+                record.raw.data = p ;
+                p = q < end ? q : end ;
+                record.raw.len = p - record.raw.data ;
+            }
+            // a broken group goes into the next chunk
+            int broken = eof ? 0 : chunk.num % group_size ;
+            if( broken > 0 ) {
+                chunk.num -= broken ;
+                p = chunk.records[chunk.num].raw.data ;
+            }
+            return p - begin ;
+        }
+
+        ByteSource * source ;
+        size_t block_size ;
+        int group_size ;
+        bool eof ;
+        std::vector<char> carry ;
+};
+#endif
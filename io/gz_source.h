@@ -0,0 +1,310 @@
+#ifndef IO_GZ_SOURCE_H
+#define IO_GZ_SOURCE_H
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <zlib.h>
+#include "../thread/mpmc_queue.h"
+
+//
+// a source of ( decompressed ) bytes.
+//
+struct ByteSource {
+    virtual ~ByteSource() {}
+    // @return : bytes copied into buf , 0 means end of file.
+    virtual size_t Read(char * buf , size_t n) = 0 ;
+};
+
+//
+// plain file , read with large blocks.
+//
+class FileSource : public ByteSource {
+    public:
+        explicit FileSource(const std::string & file){
+            fp = fopen(file.c_str(),"rb");
+            if( fp == NULL ) {
+                std::cerr<<"ERROR : failed to open \""<<file<<"\" , exit ..."<<std::endl;
+                exit(1);
+            }
+        }
+        ~FileSource() { fclose(fp); }
+        size_t Read(char * buf , size_t n) { return fread(buf,1,n,fp); }
+    private:
+        FILE * fp ;
+};
+
+//
+// decompress a gzip file with threads in front of the consumer :
+//   BGZF     : blocks are independent deflate streams , batches of blocks
+//              are inflated by `threads` threads and delivered in order.
+//   other    : one dedicated thread inflates with large buffers , members
+//              of a multi-member gzip are decoded one after another.
+// decompressed chunks come from a fixed pool , so the inflate threads wait
+// when the consumer is slower , instead of eating memory.
+//
+class ParallelGzSource : public ByteSource {
+    public:
+        ParallelGzSource(const std::string & file , int threads)
+            : name(file) , tasks(threads*2+2) , pool(threads*2+4)
+            , next_seq(0) , total_seq(-1) , current(NULL) {
+            fp = fopen(file.c_str(),"rb");
+            if( fp == NULL ) Fail("failed to open");
+            setvbuf(fp,NULL,_IOFBF,IN_CHUNK);
+            for( size_t i = 0 ; i < pool.Capacity() ; i ++ ) {
+                Chunk * chunk = new Chunk();
+                chunks.push_back(chunk);
+                pool.Push(chunk);
+            }
+            bgzf = DetectBgzf();
+            if( bgzf ) {
+                readers.push_back(std::thread([this](){ SplitBgzf(); }));
+                for( int i = 0 ; i < threads ; i ++ )
+                    readers.push_back(std::thread([this](){ InflateBgzf(); }));
+            } else
+                readers.push_back(std::thread([this](){ InflateStream(); }));
+        }
+        // a source dropped before its end closes both queues , so inflate
+        // threads waiting for a free chunk stop instead of blocking join .
+        ~ParallelGzSource(){
+            pool.Close();
+            tasks.Close();
+            for( auto & t : readers ) t.join();
+            for( Chunk * chunk : chunks ) delete chunk ;
+            fclose(fp);
+        }
+        bool IsBgzf() const { return bgzf ; }
+
+        size_t Read(char * buf , size_t n){
+            size_t done = 0 ;
+            while( done < n ) {
+                if( current == NULL || current->pos >= current->out.size() ) {
+                    if( current != NULL ) pool.Push(current);
+                    current = NextChunk();
+                    if( current == NULL ) break;
+                }
+                size_t len = std::min(n - done , current->out.size() - current->pos);
+                memcpy(buf + done , current->out.data() + current->pos , len);
+                current->pos += len ;
+                done += len ;
+            }
+            return done ;
+        }
+
+    private:
+        static const size_t IN_CHUNK = 1 << 20 ;
+        static const size_t OUT_CHUNK = 4 << 20 ;
+        static const int BGZF_HEADER = 18 ;
+        struct Chunk {
+            long seq ;
+            std::vector<unsigned char> in;
+            std::vector<size_t> blocks;   // BGZF : block start offsets in in
+            std::vector<char> out;
+            size_t pos ;
+        };
+
+        void Fail(const char * what){
+            std::cerr<<"ERROR : "<<what<<" gzip file \""<<name<<"\" , exit ..."<<std::endl;
+            exit(1);
+        }
+        // BGZF : gzip header with FEXTRA , XLEN=6 and subfield 'BC' .
+        bool DetectBgzf(){
+            unsigned char h[BGZF_HEADER];
+            size_t n = fread(h,1,BGZF_HEADER,fp);
+            rewind(fp);
+            return n == BGZF_HEADER && h[0] == 0x1f && h[1] == 0x8b && h[2] == 8
+                && ( h[3] & 4 ) && h[10] == 6 && h[11] == 0
+                && h[12] == 'B' && h[13] == 'C' && h[14] == 2 && h[15] == 0 ;
+        }
+        void Deliver(Chunk * chunk){
+            std::lock_guard<std::mutex> guard(lock);
+            ready[chunk->seq] = chunk ;
+            cv.notify_all();
+        }
+        void Finish(long total){
+            std::lock_guard<std::mutex> guard(lock);
+            total_seq = total ;
+            cv.notify_all();
+        }
+        // @return : next chunk in file order , NULL at end of file.
+        Chunk * NextChunk(){
+            std::unique_lock<std::mutex> guard(lock);
+            while( ready.find(next_seq) == ready.end() ) {
+                if( total_seq == next_seq ) return NULL ;
+                cv.wait(guard);
+            }
+            Chunk * chunk = ready[next_seq];
+            ready.erase(next_seq);
+            next_seq ++ ;
+            chunk->pos = 0 ;
+            return chunk ;
+        }
+
+        // cut BGZF blocks into batches of about IN_CHUNK compressed bytes.
+        void SplitBgzf(){
+            long seq = 0 ;
+            Chunk * chunk = NULL ;
+            unsigned char h[BGZF_HEADER];
+            while( true ) {
+                size_t n = fread(h,1,BGZF_HEADER,fp);
+                if( n == 0 ) break;
+                if( n != BGZF_HEADER || h[0] != 0x1f || h[1] != 0x8b || h[12] != 'B' || h[13] != 'C' )
+                    Fail("broken BGZF block in");
+                size_t size = ( h[16] | ( h[17] << 8 ) ) + 1 ;
+                if( chunk == NULL ) {
+                    if( ! pool.Pop(chunk) ) break;
+                    chunk->seq = seq ++ ;
+                    chunk->in.clear();
+                    chunk->blocks.clear();
+                }
+                size_t start = chunk->in.size();
+                chunk->blocks.push_back(start);
+                chunk->in.resize(start + size);
+                memcpy(chunk->in.data() + start , h , BGZF_HEADER);
+                if( fread(chunk->in.data() + start + BGZF_HEADER , 1 , size - BGZF_HEADER , fp) != size - BGZF_HEADER )
+                    Fail("truncated");
+                if( chunk->in.size() >= IN_CHUNK ) {
+                    tasks.Push(chunk);
+                    chunk = NULL ;
+                }
+            }
+            if( chunk != NULL ) tasks.Push(chunk);
+            tasks.Close();
+            Finish(seq);
+        }
+        void InflateBgzf(){
+            z_stream z;
+            memset(&z,0,sizeof(z));
+            if( inflateInit2(&z,-15) != Z_OK ) Fail("zlib init failed for");
+            Chunk * chunk ;
+            while( tasks.Pop(chunk) ) {
+                chunk->out.clear();
+                for( size_t i = 0 ; i < chunk->blocks.size() ; i ++ ) {
+                    size_t start = chunk->blocks[i];
+                    size_t end = i + 1 < chunk->blocks.size() ? chunk->blocks[i+1] : chunk->in.size();
+                    const unsigned char * tail = chunk->in.data() + end - 8 ;
+                    uint32_t crc = tail[0] | ( tail[1] << 8 ) | ( tail[2] << 16 ) | ( (uint32_t)tail[3] << 24 );
+                    uint32_t isize = tail[4] | ( tail[5] << 8 ) | ( tail[6] << 16 ) | ( (uint32_t)tail[7] << 24 );
+                    size_t out = chunk->out.size();
+                    chunk->out.resize(out + isize);
+                    inflateReset(&z);
+                    z.next_in = chunk->in.data() + start + BGZF_HEADER ;
+                    z.avail_in = end - 8 - start - BGZF_HEADER ;
+                    // zlib refuses a NULL next_out even for an empty block
+                    unsigned char dummy ;
+                    z.next_out = isize > 0 ? (Bytef*)chunk->out.data() + out : &dummy ;
+                    z.avail_out = isize ;
+                    int ret = inflate(&z,Z_FINISH);
+                    if( ret != Z_STREAM_END || z.avail_out != 0
+                            || crc32(0,(Bytef*)chunk->out.data() + out,isize) != crc )
+                        Fail("broken BGZF block in");
+                }
+                Deliver(chunk);
+            }
+            inflateEnd(&z);
+        }
+
+        // one thread for a normal gzip , members are decoded one by one.
+        void InflateStream(){
+            z_stream z;
+            memset(&z,0,sizeof(z));
+            if( inflateInit2(&z,15+32) != Z_OK ) Fail("zlib init failed for");
+            std::vector<unsigned char> in(IN_CHUNK);
+            long seq = 0 ;
+            bool eof = false ;
+            bool member_end = false ;
+            while( true ) {
+                Chunk * chunk ;
+                if( ! pool.Pop(chunk) ) break;
+                chunk->seq = seq ++ ;
+                chunk->out.resize(OUT_CHUNK);
+                z.next_out = (Bytef*)chunk->out.data();
+                z.avail_out = OUT_CHUNK ;
+                while( z.avail_out > 0 ) {
+                    if( z.avail_in == 0 && ! eof ) {
+                        z.avail_in = fread(in.data(),1,in.size(),fp);
+                        z.next_in = in.data();
+                        eof = ( z.avail_in == 0 ) ;
+                    }
+                    if( z.avail_in == 0 && eof ) break;
+                    if( member_end ) {
+                        inflateReset(&z);
+                        member_end = false ;
+                    }
+                    int ret = inflate(&z,Z_NO_FLUSH);
+                    if( ret == Z_STREAM_END )
+                        member_end = true ;
+                    else if ( ret != Z_OK && ret != Z_BUF_ERROR )
+                        Fail("broken");
+                }
+                chunk->out.resize(OUT_CHUNK - z.avail_out);
+                bool last = ( z.avail_in == 0 && eof );
+                if( last && ! member_end )
+                    Fail("truncated");
+                Deliver(chunk);
+                if( last ) break;
+            }
+            inflateEnd(&z);
+            Finish(seq);
+        }
+
+        std::string name;
+        FILE * fp ;
+        bool bgzf ;
+        MPMCQueue<Chunk*> tasks;
+        MPMCQueue<Chunk*> pool;
+        std::vector<Chunk*> chunks;
+        std::vector<std::thread> readers;
+        std::mutex lock;
+        std::condition_variable cv;
+        std::map<long,Chunk*> ready;
+        long next_seq ;
+        long total_seq ;
+        Chunk * current ;
+};
+
+// file in gzip format must end by ".gz" , and is inflated by
+// threads ( BGZF ) or one dedicated thread ( other gzip ) in background.
+inline ByteSource * OpenByteSource(const std::string & file , int threads = 1){
+    if( file.size() > 3 && file.compare(file.size()-3,3,".gz") == 0 )
+        return new ParallelGzSource(file,threads);
+    return new FileSource(file);
+}
+
+//
+// std::istream over a ByteSource , owns the source.
+//
+class SourceStreamBuf : public std::streambuf {
+    public:
+        explicit SourceStreamBuf(ByteSource * s) : source(s) , buffer(1<<20) {
+            setg(buffer.data(),buffer.data(),buffer.data());
+        }
+        ~SourceStreamBuf() { delete source ; }
+    protected:
+        int underflow(){
+            if( gptr() < egptr() ) return (unsigned char)*gptr();
+            size_t n = source->Read(buffer.data(),buffer.size());
+            if( n == 0 ) return EOF ;
+            setg(buffer.data(),buffer.data(),buffer.data()+n);
+            return (unsigned char)*gptr();
+        }
+    private:
+        ByteSource * source;
+        std::vector<char> buffer;
+};
+
+class SourceStream : public std::istream {
+    public:
+        explicit SourceStream(ByteSource * s) : std::istream(NULL) , buf(s) { rdbuf(&buf); }
+    private:
+        SourceStreamBuf buf;
+};
+#endif
@@ -0,0 +1,79 @@
+#ifndef KMER_BLOOM_FILTER_H
+#define KMER_BLOOM_FILTER_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include "kmer.h"
+
+//
+// blocked bloom filter over kmer hash values :
+//   every key sets / tests `hashes` bits inside one 512 bits block , so a
+//   test costs at most one cache miss , and the block can be prefetched .
+//   the filter only says "surely not in" or "maybe in" .
+//
+class BlockedBloomFilter {
+    public:
+        static const int BLOCK_BITS = 512 ;
+        static const int BLOCK_WORDS = BLOCK_BITS / 64 ;
+
+        BlockedBloomFilter() : words(NULL) , num(0) , mask(0) , hashes(0) {}
+
+        // n    : key number
+        // fpr  : wanted false positive rate , used if bytes is 0
+        // bytes: filter size , the hash number follows from it
+        void Init(size_t n , double fpr , size_t bytes){
+            if( n < 1 ) n = 1 ;
+            double bits ;
+            if( bytes > 0 ) {
+                bits = bytes * 8.0 ;
+                hashes = (int)std::lround( bits / n * std::log(2.0) );
+            } else {
+                bits = - (double)n * std::log(fpr) / ( std::log(2.0) * std::log(2.0) );
+                hashes = (int)std::lround( - std::log2(fpr) );
+            }
+            if( hashes < 1 ) hashes = 1 ;
+            if( hashes > 16 ) hashes = 16 ;
+            num = 1 ;
+            while( num * BLOCK_BITS < bits ) num <<= 1 ;
+            mask = num - 1 ;
+            // one more block to align blocks to cache lines
+            storage.assign( ( num + 1 ) * BLOCK_WORDS , 0 );
+            words = storage.data();
+            while( (uintptr_t)words % 64 != 0 ) words ++ ;
+        }
+        bool Empty() const { return num == 0 ; }
+        size_t Bytes() const { return num * BLOCK_BITS / 8 ; }
+        int Hashes() const { return hashes ; }
+
+        // hash : a well mixed hash of the key , e.g. std::hash<KmerT>
+        size_t BlockOf(uint64_t hash) const { return mixHash64(hash) & mask ; }
+        void Prefetch(size_t block) const { __builtin_prefetch(words + block * BLOCK_WORDS , 0 , 0); }
+        void Insert(uint64_t hash){
+            uint64_t * block = words + BlockOf(hash) * BLOCK_WORDS ;
+            uint32_t a = hash >> 32 , b = (uint32_t)hash | 1 ;
+            for( int i = 0 ; i < hashes ; i ++ ) {
+                uint32_t bit = ( a + i * b ) % BLOCK_BITS ;
+                block[bit/64] |= 1ULL << ( bit % 64 );
+            }
+        }
+        bool Test(uint64_t hash , size_t block_index) const {
+            const uint64_t * block = words + block_index * BLOCK_WORDS ;
+            uint32_t a = hash >> 32 , b = (uint32_t)hash | 1 ;
+            for( int i = 0 ; i < hashes ; i ++ ) {
+                uint32_t bit = ( a + i * b ) % BLOCK_BITS ;
+                if( ! ( block[bit/64] & ( 1ULL << ( bit % 64 ) ) ) )
+                    return false ;
+            }
+            return true ;
+        }
+        bool Test(uint64_t hash) const { return Test(hash,BlockOf(hash)); }
+
+    private:
+        std::vector<uint64_t> storage;
+        uint64_t * words ;
+        size_t num ;
+        size_t mask ;
+        int hashes ;
+};
+#endif
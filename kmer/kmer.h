@@ -7,6 +7,28 @@
 
 typedef unsigned long long  ubyte8;
 
+// murmur3 64bit finalizer , every input bit affects every output bit .
+inline ubyte8 mixHash64( ubyte8 x )
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDLLU;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53LLU;
+    x ^= x >> 33;
+    return x;
+}
+
+//
+// reverse complement of a full 64bit word ( 32 bases ) .
+//
+inline ubyte8 reverseComplementWord( ubyte8 x )
+{
+    x ^= 0xAAAAAAAAAAAAAAAALLU;
+    x = ( ( x & 0x3333333333333333LLU ) << 2 ) | ( ( x & 0xCCCCCCCCCCCCCCCCLLU ) >> 2 );
+    x = ( ( x & 0x0F0F0F0F0F0F0F0FLLU ) << 4 ) | ( ( x & 0xF0F0F0F0F0F0F0F0LLU ) >> 4 );
+    return __builtin_bswap64(x);
+}
+
 struct BaseStr{
     static char base2int(char base) { return  (char)(((base)&0x06)>>1)  ; }   //base ACTG => int 0123
     static char int2base(int seq) { return  "ACTG"[seq] ;}
@@ -151,7 +173,7 @@ struct Kmer
     }
     // make sure str is base2int str , not  AGCT str
     static Kmer str2Kmer(const std::vector<char> & str){
-        assert(str.size() == overlap);
+        assert((int)str.size() == overlap);
         Kmer word; word.Init();
         for (int index = 0; index < overlap; index++ )
         {
@@ -196,12 +218,7 @@ struct Kmer
     static Kmer fastReverseComp ( const Kmer &base , char seq_size )
     {
         Kmer seq = base ;
-        seq.low ^= 0xAAAAAAAAAAAAAAAALLU;
-        seq.low = ( ( seq.low & 0x3333333333333333LLU ) << 2 ) | ( ( seq.low & 0xCCCCCCCCCCCCCCCCLLU ) >> 2 );
-        seq.low = ( ( seq.low & 0x0F0F0F0F0F0F0F0FLLU ) << 4 ) | ( ( seq.low & 0xF0F0F0F0F0F0F0F0LLU ) >> 4 );
-        seq.low = ( ( seq.low & 0x00FF00FF00FF00FFLLU ) << 8 ) | ( ( seq.low & 0xFF00FF00FF00FF00LLU ) >> 8 );
-        seq.low = ( ( seq.low & 0x0000FFFF0000FFFFLLU ) << 16 ) | ( ( seq.low & 0xFFFF0000FFFF0000LLU ) >> 16 );
-        seq.low = ( ( seq.low & 0x00000000FFFFFFFFLLU ) << 32 ) | ( ( seq.low & 0xFFFFFFFF00000000LLU ) >> 32 );
+        seq.low = reverseComplementWord(seq.low);
 
         if ( seq_size < 32 )
         {
@@ -209,12 +226,7 @@ struct Kmer
             return seq;
         }
 
-        seq.high ^= 0xAAAAAAAAAAAAAAAALLU;
-        seq.high = ( ( seq.high & 0x3333333333333333LLU ) << 2 ) | ( ( seq.high & 0xCCCCCCCCCCCCCCCCLLU ) >> 2 );
-        seq.high = ( ( seq.high & 0x0F0F0F0F0F0F0F0FLLU ) << 4 ) | ( ( seq.high & 0xF0F0F0F0F0F0F0F0LLU ) >> 4 );
-        seq.high = ( ( seq.high & 0x00FF00FF00FF00FFLLU ) << 8 ) | ( ( seq.high & 0xFF00FF00FF00FF00LLU ) >> 8 );
-        seq.high = ( ( seq.high & 0x0000FFFF0000FFFFLLU ) << 16 ) | ( ( seq.high & 0xFFFF0000FFFF0000LLU ) >> 16 );
-        seq.high = ( ( seq.high & 0x00000000FFFFFFFFLLU ) << 32 ) | ( ( seq.high & 0xFFFFFFFF00000000LLU ) >> 32 );
+        seq.high = reverseComplementWord(seq.high);
         ubyte8 temp = seq.high;
         seq.high = seq.low;
         seq.low = temp;
@@ -254,13 +266,181 @@ struct Kmer
     }
 };
 
+//
+// Kmer with K fixed at compile time .
+//   K <= 32 : one 64bit word .
+//   K >  32 : two 64bit words ( high , low ) .
+// all shifts and masks are compile time constants , no runtime branch .
+//
+template<int K , bool ONE_WORD = ( K <= 32 ) >
+struct KmerT;
+
+template<int K>
+struct KmerT<K,true>
+{
+    static const int k = K ;
+    static const ubyte8 MASK = ( K == 32 ) ? ~0LLU : ( ( 1LLU << ( 2 * K % 64 ) ) - 1 ) ;
+    ubyte8 low;
+
+    bool operator < ( const KmerT & kmer1) const { return low < kmer1.low ; }
+    bool operator == ( const KmerT & kmer1) const { return low == kmer1.low ; }
+    void Init() { low = 0 ; }
+    void nextKmer ( char ch ) { low = ( ( low << 2 ) | (ubyte8)ch ) & MASK ; }
+    void prevKmer ( char ch ) { low = ( low >> 2 ) | ( (ubyte8)ch << ( 2 * ( K - 1 ) ) ) ; }
+    KmerT reverseComplement() const
+    {
+        KmerT ret ;
+        ret.low = reverseComplementWord(low) >> ( 64 - 2 * K ) ;
+        return ret ;
+    }
+    char baseAt(int i) const { return (char)( ( low >> ( 2 * ( K - 1 - i ) ) ) & 0x3 ) ; }
+    ubyte8 hash() const { return mixHash64(low) ; }
+};
+
+template<int K>
+struct KmerT<K,false>
+{
+    static const int k = K ;
+    static const ubyte8 HIGH_MASK = ( K == 64 ) ? ~0LLU : ( ( 1LLU << ( ( 2 * K - 64 ) % 64 ) ) - 1 ) ;
+    static const int RC_SHIFT = 128 - 2 * K ;
+    ubyte8 high, low;
+
+    bool operator < ( const KmerT & kmer1) const
+    {
+        return high < kmer1.high || ( high == kmer1.high && low < kmer1.low ) ;
+    }
+    bool operator == ( const KmerT & kmer1) const
+    {
+        return high == kmer1.high && low == kmer1.low ;
+    }
+    void Init() { high = 0 ; low = 0 ; }
+    void nextKmer ( char ch )
+    {
+        high = ( ( high << 2 ) | ( low >> 62 ) ) & HIGH_MASK ;
+        low = ( low << 2 ) | (ubyte8)ch ;
+    }
+    void prevKmer ( char ch )
+    {
+        low = ( low >> 2 ) | ( high << 62 ) ;
+        high = ( high >> 2 ) | ( (ubyte8)ch << ( 2 * ( K - 1 ) - 64 ) ) ;
+    }
+    KmerT reverseComplement() const
+    {
+        KmerT ret ;
+        ubyte8 h = reverseComplementWord(low) ;
+        ubyte8 l = reverseComplementWord(high) ;
+        if( RC_SHIFT == 0 ) {
+            ret.high = h ; ret.low = l ;
+        } else {
+            ret.low = ( l >> ( RC_SHIFT & 63 ) ) | ( h << ( ( 64 - RC_SHIFT ) & 63 ) ) ;
+            ret.high = h >> ( RC_SHIFT & 63 ) ;
+        }
+        return ret ;
+    }
+    char baseAt(int i) const
+    {
+        int shift = 2 * ( K - 1 - i ) ;
+        if( shift >= 64 ) return (char)( ( high >> ( shift - 64 ) ) & 0x3 ) ;
+        return (char)( ( low >> shift ) & 0x3 ) ;
+    }
+    ubyte8 hash() const { return mixHash64( low ^ mixHash64( high + 0x9E3779B97F4A7C15LLU ) ) ; }
+};
+
+template<class KmerType>
+struct KmerTUtil
+{
+    static const int K = KmerType::k ;
+    // make sure str is base2int str , not  AGCT str
+    static KmerType str2Kmer(const std::vector<char> & str)
+    {
+        assert(str.size() == K);
+        KmerType word; word.Init();
+        for (int index = 0; index < K; index++ )
+            word.nextKmer(str.at(index));
+        KmerType bal_word = word.reverseComplement();
+        if( word < bal_word )
+            return word ;
+        else
+            return bal_word;
+    }
+    static std::vector<char> ToBaseStr(const KmerType & k)
+    {
+        std::vector<char> kmer(K);
+        for( int i = 0 ; i < K ; i++ )
+            kmer[i] = k.baseAt(i);
+        return kmer;
+    }
+};
+
+//
+// walk all canonical kmers of a raw ACGT string without any allocation .
+//   forward word and reverse complement word roll together ,
+//   Next() return the smaller one of them .
+//   an N ( or n ) breaks the sequence , kmers start again after it .
+//
+// usage :
+//      CanonicalKmerIterator<KmerT<21> > it(read.data(),read.size());
+//      KmerT<21> kmer;
+//      while( it.Next(kmer) ) { ... }
+//
+template<class KmerType>
+struct CanonicalKmerIterator
+{
+    static const int K = KmerType::k ;
+    CanonicalKmerIterator(const char * s , int l)
+        : seq(s) , len(l) , pos(0) , filled(0) , count(0) { fw.Init() ; rc.Init() ; }
+
+    // go on with the next piece of the same sequence ( e.g. next fasta line ).
+    void Continue(const char * s , int l) { seq = s ; len = l ; pos = 0 ; }
+    // start a new sequence , kmers never span two sequences .
+    void Restart(const char * s , int l) { Continue(s,l) ; filled = 0 ; count = 0 ; fw.Init() ; rc.Init() ; }
+    // kmers returned since the start of the sequence
+    long Count() const { return count ; }
+
+    bool Next(KmerType & kmer)
+    {
+        while( pos < len ) {
+            char b = seq[pos++];
+            if( ( b & 0xDF ) == 'N' ) {
+                filled = 0 ;
+                continue ;
+            }
+            char c = BaseStr::base2int(b);
+            fw.nextKmer(c);
+            rc.prevKmer(BaseStr::int_comp(c));
+            if( filled < K ) filled ++ ;
+            if( filled == K ) {
+                kmer = fw < rc ? fw : rc ;
+                count ++ ;
+                return true ;
+            }
+        }
+        return false ;
+    }
+
+    const char * seq ;
+    int len ;
+    int pos ;
+    int filled ;
+    long count ;
+    KmerType fw , rc ;
+};
+
 namespace std{
 	template<>
 		struct hash<Kmer>
 		{
 			size_t operator()(const Kmer& x) const
 			{
-				return x.low;
+				return mixHash64( x.low ^ mixHash64( x.high + 0x9E3779B97F4A7C15LLU ) );
+			}
+		};
+	template<int K,bool ONE_WORD>
+		struct hash<KmerT<K,ONE_WORD> >
+		{
+			size_t operator()(const KmerT<K,ONE_WORD>& x) const
+			{
+				return x.hash();
 			}
 		};
 }
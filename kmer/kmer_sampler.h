@@ -0,0 +1,115 @@
+#ifndef KMER_KMER_SAMPLER_H
+#define KMER_KMER_SAMPLER_H
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include "kmer.h"
+
+//
+// which kmers of a read are looked up :
+//   ALL       : every kmer
+//   STRIDE s  : every s-th kmer
+//   MINIMIZER w : the smallest kmer ( by hash ) of every w consecutive kmers ,
+//               each selected kmer once
+//   MOD d     : kmers whose hash is 0 modulo d . the choice does not depend
+//               on the read , so an index loaded with the same MOD keeps
+//               only these kmers and is d times smaller .
+//
+struct KmerSampling {
+    enum Mode { ALL = 0 , STRIDE , MINIMIZER , MOD };
+    Mode mode ;
+    int step ;
+    KmerSampling() : mode(ALL) , step(1) {}
+
+    // parse "stride:s" , "minimizer:w" or "mod:d"
+    // @return : false if str is not valid
+    bool Parse(const char * str){
+        char name[16] = {0};
+        int n = 0 ;
+        if( sscanf(str,"%15[a-z]:%d",name,&n) != 2 || n < 1 ) return false ;
+        if( strcmp(name,"stride") == 0 ) mode = STRIDE ;
+        else if ( strcmp(name,"minimizer") == 0 ) mode = MINIMIZER ;
+        else if ( strcmp(name,"mod") == 0 ) mode = MOD ;
+        else return false ;
+        step = n ;
+        if( mode == MINIMIZER && step > MAX_WINDOW ) return false ;
+        return true ;
+    }
+    static const int MAX_WINDOW = 64 ;
+
+    // order of kmers , independent from the table hash bits
+    static uint64_t Order(uint64_t hash) { return mixHash64(hash ^ 0x2545F4914F6CDD1DULL) ; }
+    bool Keep(uint64_t hash) const { return mode != MOD || Order(hash) % step == 0 ; }
+};
+
+template<class KmerType>
+struct SampledKmerIterator {
+    SampledKmerIterator(const char * s , int l , const KmerSampling & m)
+        : it(s,l) , sampling(m) , n(0) , min_pos(-1) , emitted(-1) {}
+
+    bool Next(KmerType & kmer){
+        switch( sampling.mode ) {
+            case KmerSampling::ALL :
+                return it.Next(kmer);
+            case KmerSampling::STRIDE :
+                while( it.Next(kmer) )
+                    if( n ++ % sampling.step == 0 ) return true ;
+                return false ;
+            case KmerSampling::MOD :
+                while( it.Next(kmer) )
+                    if( sampling.Keep(std::hash<KmerType>()(kmer)) ) return true ;
+                return false ;
+            case KmerSampling::MINIMIZER :
+                return NextMinimizer(kmer);
+        }
+        return false ;
+    }
+    // kmers of the read walked so far , sampled or not
+    long Walked() const { return it.Count() ; }
+
+    private:
+        struct Entry {
+            KmerType kmer ;
+            uint64_t order ;
+            long pos ;
+        };
+        bool NextMinimizer(KmerType & kmer){
+            const int w = sampling.step ;
+            KmerType k ;
+            while( it.Next(k) ) {
+                Entry & e = ring[n % w];
+                e.kmer = k ;
+                e.order = KmerSampling::Order(std::hash<KmerType>()(k));
+                e.pos = n ++ ;
+                if( min_pos < 0 || min_pos < n - w ) {
+                    // the minimum left the window , scan it again
+                    min_pos = -1 ;
+                    for( long p = n - w < 0 ? 0 : n - w ; p < n ; p ++ )
+                        if( min_pos < 0 || ring[p % w].order < ring[min_pos % w].order )
+                            min_pos = p ;
+                } else if ( e.order < ring[min_pos % w].order )
+                    min_pos = e.pos ;
+                if( n >= w && min_pos != emitted ) {
+                    emitted = min_pos ;
+                    kmer = ring[min_pos % w].kmer ;
+                    return true ;
+                }
+            }
+            // a read shorter than one window still gives its minimum
+            if( n > 0 && n < w && emitted < 0 ) {
+                emitted = min_pos ;
+                kmer = ring[min_pos % w].kmer ;
+                return true ;
+            }
+            return false ;
+        }
+
+        CanonicalKmerIterator<KmerType> it ;
+        const KmerSampling & sampling ;
+        long n ;          // kmers seen
+        long min_pos ;    // position of the window minimum
+        long emitted ;    // position of the last selected kmer
+        Entry ring[KmerSampling::MAX_WINDOW];
+};
+#endif
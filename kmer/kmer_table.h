@@ -0,0 +1,469 @@
+#ifndef KMER_KMER_TABLE_H
+#define KMER_KMER_TABLE_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <cassert>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+#include "kmer.h"
+
+//
+// one open addressing (linear probing) table for all haplotypes :
+//      canonical kmer -> index of the haplotype that owns it .
+// so each read kmer cost one probe whatever the haplotype number is .
+//
+template<class Key , class Hash = std::hash<Key> >
+struct KmerHapTable {
+    typedef uint16_t hap_t;
+    typedef Key key_type;
+    static const hap_t EMPTY = 0xFFFF ;  // slot never used
+    static const hap_t NOHAP = 0xFFFE ;  // kmer erased or shared by >1 haplotypes
+    static const hap_t MAX_HAP = 0xFFFD ;
+    struct Slot {
+        Key   key;
+        hap_t hap;
+    };
+
+    KmerHapTable() : slots(NULL) , capacity(0) , mask(0) , used(0) , shared(0) { Init(1024); }
+
+    // expect : kmer number expected , table grows by itself if it is too small.
+    void Init(size_t expect){
+        size_t cap = 1024 ;
+        while( cap * 7 < expect * 10 ) cap <<= 1 ;
+        Fill(storage,cap);
+        slots = storage.data();
+        capacity = cap ;
+        mask = cap - 1 ;
+        used = 0 ;
+        shared = 0 ;
+    }
+
+    // use slots owned by others ( e.g. mmap of an index file ) , read only .
+    void Attach(const Slot * data , size_t cap , size_t u , size_t s){
+        std::vector<Slot>().swap(storage);
+        slots = const_cast<Slot*>(data);
+        capacity = cap ;
+        mask = cap - 1 ;
+        used = u ;
+        shared = s ;
+    }
+    bool Attached() const { return slots != storage.data() ; }
+
+    // the same kmer recorded by two haplotypes is not haplotype specific ,
+    // it is kept as NOHAP and never vote .
+    void Insert(const Key & key , int hap){
+        assert( ! Attached() );
+        if( (used + 1) * 10 > capacity * 7 )
+            Rehash(capacity * 2);
+        Slot & slot = slots[Locate(key)];
+        if( slot.hap == EMPTY ) {
+            slot.key = key ;
+            slot.hap = (hap_t)hap ;
+            used ++ ;
+        } else if ( slot.hap != (hap_t)hap && slot.hap != NOHAP ) {
+            slot.hap = NOHAP ;
+            shared ++ ;
+        }
+    }
+
+    // @return : owner haplotype or -1 .
+    int Find(const Key & key) const {
+        hap_t hap = slots[Locate(key)].hap;
+        if( hap >= NOHAP ) return -1 ;
+        return hap ;
+    }
+
+    // batched lookup : take Bucket of many keys and Prefetch them first ,
+    // then FindAt , so the cache misses of independent probes overlap .
+    static size_t HashOf(const Key & key) { return Hash()(key) ; }
+    size_t BucketOf(size_t hash) const { return hash & mask ; }
+    size_t Bucket(const Key & key) const { return BucketOf(HashOf(key)) ; }
+    void Prefetch(size_t bucket) const { __builtin_prefetch(slots + bucket , 0 , 0); }
+    int FindAt(const Key & key , size_t bucket) const {
+        size_t i = bucket ;
+        while( slots[i].hap != EMPTY && !(slots[i].key == key) )
+            i = ( i + 1 ) & mask ;
+        if( slots[i].hap >= NOHAP ) return -1 ;
+        return slots[i].hap ;
+    }
+
+    // @return : owner haplotype before erase or -1 .
+    int Erase(const Key & key){
+        assert( ! Attached() );
+        Slot & slot = slots[Locate(key)];
+        if( slot.hap >= NOHAP ) return -1 ;
+        int hap = slot.hap ;
+        slot.hap = NOHAP ;
+        return hap ;
+    }
+
+    size_t Size() const { return used ; }
+    size_t Capacity() const { return capacity ; }
+    size_t Shared() const { return shared ; }
+
+    // Insert for PartitionedInserter : the probe gives up at slot stop .
+    // @return : NEW_SLOT , NEW_SHARED , 0 if nothing changes ,
+    //           -1 if stop is reached , the caller counts used and shared .
+    enum { NEW_SLOT = 1 , NEW_SHARED = 2 };
+    int InsertBefore(const Key & key , size_t hash , int hap , size_t stop){
+        size_t i = hash & mask ;
+        for( size_t n = 0 ; ; n ++ , i = ( i + 1 ) & mask ) {
+            if( ( i == stop && n > 0 ) || n > mask ) return -1 ;
+            if( slots[i].hap == EMPTY || slots[i].key == key ) break ;
+        }
+        Slot & slot = slots[i];
+        if( slot.hap == EMPTY ) {
+            slot.key = key ;
+            slot.hap = (hap_t)hap ;
+            return NEW_SLOT ;
+        }
+        if ( slot.hap != (hap_t)hap && slot.hap != NOHAP ) {
+            slot.hap = NOHAP ;
+            return NEW_SHARED ;
+        }
+        return 0 ;
+    }
+    void AddCounts(size_t u , size_t s) { used += u ; shared += s ; }
+    // grow if more kmers came than Init expected
+    void Fit(){
+        if( used * 10 > capacity * 7 ) {
+            size_t cap = capacity ;
+            while( used * 10 > cap * 7 ) cap <<= 1 ;
+            Rehash(cap);
+        }
+    }
+    // linear probing fills the same slots whatever the insert order is ,
+    // only the order inside a run of used slots differs . sort every run by
+    // ( home bucket , key ) , then the same kmers give the same slots .
+    void Canonical(){
+        size_t start = 0 ;
+        while( slots[start].hap != EMPTY ) start ++ ;
+        std::vector<Slot> run ;
+        for( size_t n = 1 ; n <= capacity ; n ++ ) {
+            size_t i = ( start + n ) & mask ;
+            if( slots[i].hap != EMPTY ) {
+                run.push_back(slots[i]);
+                continue ;
+            }
+            if( run.size() > 1 ) {
+                size_t first = ( i - run.size() ) & mask ;
+                std::sort(run.begin(),run.end(),[this,first](const Slot & a , const Slot & b){
+                    size_t ha = ( Bucket(a.key) - first ) & mask ;
+                    size_t hb = ( Bucket(b.key) - first ) & mask ;
+                    return ha != hb ? ha < hb : memcmp(&a.key,&b.key,sizeof(Key)) < 0 ;
+                });
+                for( size_t r = 0 ; r < run.size() ; r ++ )
+                    slots[( first + r ) & mask] = run[r];
+            }
+            run.clear();
+        }
+    }
+
+    std::vector<Slot> storage;
+    Slot * slots;
+    size_t capacity ;
+    size_t mask ;
+    size_t used ;
+    size_t shared ;
+
+    private:
+        // cap empty slots , padding bytes of Slot are zero too , slots are
+        // written to index files as they are .
+        static void Fill(std::vector<Slot> & to , size_t cap){
+            to.resize(cap);
+            memset((void *)to.data(),0,cap * sizeof(Slot));
+            for( Slot & slot : to ) {
+                slot.key = Key() ;
+                slot.hap = EMPTY ;
+            }
+        }
+        // @return : slot of key , or the empty slot key should be put in .
+        size_t Locate(const Key & key) const {
+            size_t i = Hash()(key) & mask ;
+            while( slots[i].hap != EMPTY && !(slots[i].key == key) )
+                i = ( i + 1 ) & mask ;
+            return i ;
+        }
+        void Rehash(size_t cap){
+            std::vector<Slot> old ;
+            old.swap(storage);
+            Fill(storage,cap);
+            slots = storage.data();
+            capacity = cap ;
+            mask = cap - 1 ;
+            for( const Slot & slot : old ) {
+                if( slot.hap == EMPTY ) continue ;
+                slots[Locate(slot.key)] = slot ;
+            }
+        }
+};
+
+//
+// many threads insert into one KmerHapTable of a known size :
+//   the table is cut into ranges of home buckets , each thread keeps the
+//   kmers it adds in a pending list per range , a full list is inserted
+//   under the locks of its range and the next one , so probes running
+//   into the next range are safe . a probe running further , rare at load
+//   0.7 , is kept aside and inserted alone by Finish .
+// the table content is the same as inserting all kmers one by one , and
+// Finish puts slots in Canonical order , so thread timing changes nothing .
+//
+//   PartitionedInserter<Table> inserter(table,expect);
+//   // in every thread
+//   PartitionedInserter<Table>::Batch batch(inserter);
+//   batch.Add(kmer,table.HashOf(kmer),hap); ... batch.Flush();
+//   // after all threads
+//   inserter.Finish();
+//
+template<class Table>
+class PartitionedInserter {
+    public:
+        typedef typename Table::Slot Slot ;
+        static const size_t FLUSH_SIZE = 256 ;
+        static const int MAX_RANGE_BITS = 10 ;
+        static const int MIN_RANGE_SLOT_BITS = 10 ;
+
+        // expect : kmer number expected , the table is cleared.
+        PartitionedInserter(Table & t , size_t expect) : table(t) , used(0) , shared(0) {
+            table.Init(expect);
+            int cap_bits = 0 ;
+            while( ( (size_t)1 << cap_bits ) < table.Capacity() ) cap_bits ++ ;
+            range_bits = std::max(0,std::min((int)MAX_RANGE_BITS,cap_bits - MIN_RANGE_SLOT_BITS));
+            shift = cap_bits - range_bits ;
+            ranges = (size_t)1 << range_bits ;
+            std::vector<std::mutex>(ranges).swap(locks);
+        }
+
+        class Batch {
+            public:
+                explicit Batch(PartitionedInserter & o) : owner(o) , pending(o.ranges) {}
+                ~Batch() { Flush(); }
+                void Add(const typename Table::key_type & key , size_t hash , int hap){
+                    size_t r = owner.RangeOf(hash);
+                    Slot slot ;
+                    slot.key = key ;
+                    slot.hap = hap ;
+                    pending[r].push_back(std::make_pair(slot,hash));
+                    if( pending[r].size() >= FLUSH_SIZE ) owner.Insert(r,pending[r]);
+                }
+                void Flush(){
+                    for( size_t r = 0 ; r < pending.size() ; r ++ )
+                        if( ! pending[r].empty() ) owner.Insert(r,pending[r]);
+                }
+            private:
+                friend class PartitionedInserter ;
+                PartitionedInserter & owner ;
+                std::vector<std::vector<std::pair<Slot,size_t> > > pending ;
+        };
+
+        // all Batch are flushed
+        void Finish(){
+            table.AddCounts(used,shared);
+            for( const auto & e : rest )
+                table.Insert(e.key,e.hap);
+            rest.clear();
+            table.Fit();
+            table.Canonical();
+        }
+
+    private:
+        friend class Batch ;
+        size_t RangeOf(size_t hash) const { return ( hash & table.mask ) >> shift ; }
+        void Insert(size_t r , std::vector<std::pair<Slot,size_t> > & entries){
+            size_t next = ( r + 1 ) & ( ranges - 1 );
+            size_t stop = ( ( r + 2 ) & ( ranges - 1 ) ) << shift ;
+            size_t u = 0 , s = 0 ;
+            std::vector<Slot> far ;
+            {
+                std::lock_guard<std::mutex> first(locks[std::min(r,next)]);
+                std::unique_lock<std::mutex> second ;
+                if( next != r ) second = std::unique_lock<std::mutex>(locks[std::max(r,next)]);
+                for( const auto & e : entries ) {
+                    int ret = table.InsertBefore(e.first.key,e.second,e.first.hap,stop);
+                    if( ret == Table::NEW_SLOT ) u ++ ;
+                    else if ( ret == Table::NEW_SHARED ) s ++ ;
+                    else if ( ret < 0 ) far.push_back(e.first);
+                }
+            }
+            entries.clear();
+            std::lock_guard<std::mutex> guard(counts_lock);
+            used += u ;
+            shared += s ;
+            rest.insert(rest.end(),far.begin(),far.end());
+        }
+
+        Table & table ;
+        int range_bits , shift ;
+        size_t ranges ;
+        std::vector<std::mutex> locks ;
+        std::mutex counts_lock ;
+        size_t used , shared ;
+        std::vector<Slot> rest ;
+};
+
+//
+// open addressing table used to extract species unique kmers :
+//      canonical kmer -> ( the only species has it , count in that species ) .
+// a kmer seen in more than one species is marked MULTI .
+//
+template<class Key , class Hash = std::hash<Key> >
+struct KmerSpeciesTable {
+    typedef uint16_t species_t;
+    static const species_t EMPTY = 0xFFFF ;
+    static const species_t MULTI = 0xFFFE ;
+    static const species_t MAX_SPECIES = 0xFFFD ;
+    struct Slot {
+        Key       key;
+        species_t species;
+        uint32_t  count;
+    };
+
+    KmerSpeciesTable() : used(0) { Rehash(1024); }
+
+    void Add(const Key & key , int species){
+        if( (used + 1) * 10 > slots.size() * 7 )
+            Rehash(slots.size() * 2);
+        Slot & slot = slots[Locate(key)];
+        if( slot.species == EMPTY ) {
+            slot.key = key ;
+            slot.species = (species_t)species ;
+            slot.count = 1 ;
+            used ++ ;
+        } else if ( slot.species == (species_t)species ) {
+            if( slot.count < 0xFFFFFFFF ) slot.count ++ ;
+        } else
+            slot.species = MULTI ;
+    }
+
+    size_t Size() const { return used ; }
+
+    std::vector<Slot> slots;
+    size_t used ;
+
+    private:
+        size_t Locate(const Key & key) const {
+            size_t mask = slots.size() - 1 ;
+            size_t i = Hash()(key) & mask ;
+            while( slots[i].species != EMPTY && !(slots[i].key == key) )
+                i = ( i + 1 ) & mask ;
+            return i ;
+        }
+        void Rehash(size_t cap){
+            std::vector<Slot> old ;
+            old.swap(slots);
+            Slot empty ; empty.key = Key() ; empty.species = EMPTY ; empty.count = 0 ;
+            slots.assign(cap,empty);
+            for( const Slot & slot : old ) {
+                if( slot.species == EMPTY ) continue ;
+                slots[Locate(slot.key)] = slot ;
+            }
+        }
+};
+
+//
+// open addressing table of a persistent species panel :
+//      canonical kmer -> ( species having it , of them passed the count
+//                          filter , xor of both id sets ) .
+// ids are added and removed one by one , so only the kmers of one species
+// are touched . a kmer is unique to species s if s is the only species
+// having it and s passed , then passed_xor is s .
+// a kmer no species has any more stays as a dead slot until saved .
+//
+template<class Key , class Hash = std::hash<Key> >
+struct KmerPanelTable {
+    typedef uint16_t species_t;
+    static const species_t EMPTY = 0xFFFF ;
+    static const species_t MAX_SPECIES = 0xFFFD ;
+    struct Slot {
+        Key       key;
+        species_t species;      // number of species having key , EMPTY if never used
+        species_t passed;       // number of them with count in [lower,upper]
+        species_t species_xor;
+        species_t passed_xor;
+    };
+
+    KmerPanelTable() : used(0) { Rehash(1024); }
+
+    // @return : the species key is unique to , -1 if none
+    static int Owner(const Slot & slot) {
+        return slot.species == 1 && slot.passed == 1 ? slot.passed_xor : -1 ;
+    }
+    static bool Live(const Slot & slot) { return slot.species != EMPTY && slot.species > 0 ; }
+
+    // @return : owners of key before and after , see Owner
+    std::pair<int,int> Add(const Key & key , int id , bool pass){
+        if( (used + 1) * 10 > slots.size() * 7 )
+            Rehash(slots.size() * 2);
+        Slot & slot = slots[Locate(key)];
+        if( slot.species == EMPTY ) {
+            slot.key = key ;
+            slot.species = slot.passed = slot.species_xor = slot.passed_xor = 0 ;
+            used ++ ;
+        }
+        int owner = Owner(slot);
+        slot.species ++ ;
+        slot.species_xor ^= id ;
+        if( pass ) {
+            slot.passed ++ ;
+            slot.passed_xor ^= id ;
+        }
+        return std::make_pair(owner,Owner(slot));
+    }
+    // @return : owners of key before and after , ( -2 , -2 ) if no species has key
+    std::pair<int,int> Remove(const Key & key , int id , bool pass){
+        Slot & slot = slots[Locate(key)];
+        if( ! Live(slot) || ( pass && slot.passed == 0 ) ) return std::make_pair(-2,-2);
+        int owner = Owner(slot);
+        slot.species -- ;
+        slot.species_xor ^= id ;
+        if( pass ) {
+            slot.passed -- ;
+            slot.passed_xor ^= id ;
+        }
+        return std::make_pair(owner,Owner(slot));
+    }
+    // put a saved slot back
+    void Put(const Slot & saved){
+        if( (used + 1) * 10 > slots.size() * 7 )
+            Rehash(slots.size() * 2);
+        slots[Locate(saved.key)] = saved ;
+        used ++ ;
+    }
+    void Reserve(size_t n){
+        size_t cap = slots.size();
+        while( cap * 7 < n * 10 ) cap <<= 1 ;
+        if( cap > slots.size() ) Rehash(cap);
+    }
+
+    size_t Size() const { return used ; }
+
+    std::vector<Slot> slots;
+    size_t used ;
+
+    private:
+        size_t Locate(const Key & key) const {
+            size_t mask = slots.size() - 1 ;
+            size_t i = Hash()(key) & mask ;
+            while( slots[i].species != EMPTY && !(slots[i].key == key) )
+                i = ( i + 1 ) & mask ;
+            return i ;
+        }
+        void Rehash(size_t cap){
+            std::vector<Slot> old ;
+            old.swap(slots);
+            Slot empty ;
+            empty.key = Key() ;
+            empty.species = EMPTY ;
+            empty.passed = empty.species_xor = empty.passed_xor = 0 ;
+            slots.assign(cap,empty);
+            for( const Slot & slot : old ) {
+                if( slot.species == EMPTY ) continue ;
+                slots[Locate(slot.key)] = slot ;
+            }
+        }
+};
+#endif
@@ -0,0 +1,238 @@
+#ifndef KMER_MPHF_H
+#define KMER_MPHF_H
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+#include "kmer.h"
+
+//
+// minimal perfect hash of a fixed set of 64 bits keys ( BBHash like ) :
+//   level l is a bit array of gamma * ( keys left ) bits , a key sets the
+//   bit it hashes to , keys hitting the same bit go to the next level .
+//   index of a key is the rank of its bit over all levels , keys still left
+//   after MAX_LEVEL levels are kept sorted after them .
+// all data lives in one uint64_t array , so it is saved as it is and used
+// directly from a mapped file .
+//
+//   words : key_num level_num fallback_num bit_words
+//           level_offset[level_num] level_words[level_num]
+//           bits[bit_words] ranks[bit_words/8+1] fallback[fallback_num]
+//
+class Mphf {
+    public:
+        static const int MAX_LEVEL = 32 ;
+        static const uint64_t NONE = ~0ULL ;
+
+        Mphf() : data(NULL) , word_num(0) {}
+
+        // keys : unique keys
+        void Build(const std::vector<uint64_t> & keys , double gamma = 2.0){
+            std::vector<std::vector<uint64_t> > levels;
+            std::vector<uint64_t> cur(keys) , next ;
+            for( int l = 0 ; l < MAX_LEVEL && ! cur.empty() ; l ++ ) {
+                size_t lw = (size_t)( gamma * cur.size() / 64 ) + 1 ;
+                std::vector<uint64_t> bits(lw,0) , coll(lw,0);
+                for( uint64_t key : cur ) {
+                    uint64_t p = Pos(key,l,lw*64);
+                    uint64_t m = 1ULL << ( p % 64 );
+                    if( bits[p/64] & m ) coll[p/64] |= m ;
+                    else bits[p/64] |= m ;
+                }
+                for( size_t i = 0 ; i < lw ; i ++ ) bits[i] &= ~coll[i];
+                next.clear();
+                for( uint64_t key : cur ) {
+                    uint64_t p = Pos(key,l,lw*64);
+                    if( coll[p/64] & ( 1ULL << ( p % 64 ) ) ) next.push_back(key);
+                }
+                levels.push_back(std::vector<uint64_t>());
+                levels.back().swap(bits);
+                cur.swap(next);
+            }
+            std::sort(cur.begin(),cur.end());
+            size_t bit_words = 0 ;
+            for( const auto & level : levels ) bit_words += level.size();
+            size_t blocks = bit_words / 8 + 1 ;
+            storage.clear();
+            storage.push_back(keys.size());
+            storage.push_back(levels.size());
+            storage.push_back(cur.size());
+            storage.push_back(bit_words);
+            for( size_t l = 0 , off = 0 ; l < levels.size() ; off += levels[l].size() , l ++ )
+                storage.push_back(off);
+            for( const auto & level : levels ) storage.push_back(level.size());
+            for( const auto & level : levels ) storage.insert(storage.end(),level.begin(),level.end());
+            const uint64_t * bits = storage.data() + storage.size() - bit_words ;
+            uint64_t ones = 0 ;
+            std::vector<uint64_t> ranks(blocks);
+            for( size_t b = 0 ; b < blocks ; b ++ ) {
+                ranks[b] = ones ;
+                for( size_t i = b * 8 ; i < b * 8 + 8 && i < bit_words ; i ++ )
+                    ones += __builtin_popcountll(bits[i]);
+            }
+            storage.insert(storage.end(),ranks.begin(),ranks.end());
+            storage.insert(storage.end(),cur.begin(),cur.end());
+            Attach(storage.data(),storage.size());
+        }
+
+        // use words owned by others ( e.g. mmap of an index file ) .
+        // @return : false if words are broken
+        bool Attach(const uint64_t * words , size_t n){
+            if( n < 4 ) return false ;
+            data = words ;
+            word_num = n ;
+            key_num = data[0] ;
+            level_num = data[1] ;
+            fallback_num = data[2] ;
+            bit_words = data[3] ;
+            if( level_num > MAX_LEVEL ) return false ;
+            offsets = data + 4 ;
+            level_words = offsets + level_num ;
+            bits = level_words + level_num ;
+            ranks = bits + bit_words ;
+            fallback = ranks + bit_words / 8 + 1 ;
+            return (size_t)( fallback + fallback_num - data ) == n ;
+        }
+        const uint64_t * Words() const { return data ; }
+        size_t WordNum() const { return word_num ; }
+        uint64_t Size() const { return key_num ; }
+
+        // @return : index in [0,Size()) of a key in set ,
+        //           any index or NONE for other keys .
+        uint64_t Lookup(uint64_t key) const {
+            for( uint64_t l = 0 ; l < level_num ; l ++ ) {
+                uint64_t p = Pos(key,l,level_words[l]*64);
+                uint64_t w = offsets[l] + p / 64 ;
+                if( ( bits[w] >> ( p % 64 ) ) & 1 )
+                    return Rank(w , p % 64);
+            }
+            const uint64_t * end = fallback + fallback_num ;
+            const uint64_t * it = std::lower_bound(fallback,end,key);
+            if( it == end || *it != key ) return NONE ;
+            return key_num - fallback_num + ( it - fallback );
+        }
+        // most keys stop at level 0 .
+        void Prefetch(uint64_t key) const {
+            if( level_num == 0 ) return ;
+            uint64_t w = Pos(key,0,level_words[0]*64) / 64 ;
+            __builtin_prefetch(bits + w , 0 , 0);
+            __builtin_prefetch(ranks + w / 8 , 0 , 0);
+        }
+
+    private:
+        static uint64_t Pos(uint64_t key , uint64_t level , uint64_t nbits){
+            uint64_t h = mixHash64( key + ( level + 1 ) * 0x9E3779B97F4A7C15ULL );
+            return (uint64_t)( ( (unsigned __int128)h * nbits ) >> 64 );
+        }
+        uint64_t Rank(uint64_t w , uint64_t b) const {
+            uint64_t r = ranks[w/8];
+            for( uint64_t i = w / 8 * 8 ; i < w ; i ++ )
+                r += __builtin_popcountll(bits[i]);
+            if( b > 0 ) r += __builtin_popcountll(bits[w] & ( ( 1ULL << b ) - 1 ));
+            return r ;
+        }
+
+        std::vector<uint64_t> storage;
+        const uint64_t * data ;
+        size_t word_num ;
+        uint64_t key_num , level_num , fallback_num , bit_words ;
+        const uint64_t * offsets ;
+        const uint64_t * level_words ;
+        const uint64_t * bits ;
+        const uint64_t * ranks ;
+        const uint64_t * fallback ;
+};
+
+//
+// static key -> haplotype table on a minimal perfect hash :
+//   every key owns fp_bits bits of fingerprint and hap_bits bits of
+//   haplotype in a packed array , about ( 3.7 + fp_bits + hap_bits ) bits
+//   per key . a key not in set is taken as a member with 2^-fp_bits chance .
+//
+//   words : fp_bits hap_bits mphf_words mphf[mphf_words] entries[...]
+//
+class CompactHapTable {
+    public:
+        CompactHapTable() : data(NULL) , word_num(0) {}
+
+        // entries : ( key , hap ) with unique keys
+        void Build(const std::vector<std::pair<uint64_t,uint16_t> > & entries ,
+                int fp_bits , int hap_num){
+            int hap_bits = 1 ;
+            while( ( 1 << hap_bits ) < hap_num ) hap_bits ++ ;
+            std::vector<uint64_t> keys;
+            keys.reserve(entries.size());
+            for( const auto & e : entries ) keys.push_back(e.first);
+            Mphf m ;
+            m.Build(keys);
+            std::vector<uint64_t>().swap(keys);
+            int width = fp_bits + hap_bits ;
+            storage.assign(3,0);
+            storage[0] = fp_bits ;
+            storage[1] = hap_bits ;
+            storage[2] = m.WordNum() ;
+            storage.insert(storage.end(),m.Words(),m.Words()+m.WordNum());
+            size_t base = storage.size();
+            storage.resize(base + ( entries.size() * width + 63 ) / 64 + 1 , 0);
+            for( const auto & e : entries ) {
+                uint64_t v = Fingerprint(e.first,fp_bits) | ( (uint64_t)e.second << fp_bits );
+                uint64_t bit = m.Lookup(e.first) * width ;
+                uint64_t * w = storage.data() + base + bit / 64 ;
+                w[0] |= v << ( bit % 64 );
+                if( bit % 64 + width > 64 ) w[1] |= v >> ( 64 - bit % 64 );
+            }
+            Attach(storage.data(),storage.size());
+        }
+
+        // use words owned by others ( e.g. mmap of an index file ) .
+        // @return : false if words are broken
+        bool Attach(const uint64_t * words , size_t n){
+            if( n < 3 || words[0] > 32 || words[1] > 16 || 3 + words[2] > n ) return false ;
+            data = words ;
+            word_num = n ;
+            fp_bits = words[0] ;
+            width = fp_bits + words[1] ;
+            mask = ( 1ULL << width ) - 1 ;
+            if( ! mphf.Attach(words + 3 , words[2]) ) return false ;
+            entries = words + 3 + words[2] ;
+            return (size_t)( entries - words ) + ( mphf.Size() * width + 63 ) / 64 + 1 <= n ;
+        }
+        const uint64_t * Words() const { return data ; }
+        size_t WordNum() const { return word_num ; }
+        uint64_t Size() const { return mphf.Size() ; }
+
+        // batched lookup : Prefetch , then Index and PrefetchEntry , then FindAt .
+        void Prefetch(uint64_t key) const { mphf.Prefetch(key); }
+        uint64_t Index(uint64_t key) const { return mphf.Lookup(key); }
+        void PrefetchEntry(uint64_t index) const {
+            if( index != Mphf::NONE ) __builtin_prefetch(entries + index * width / 64 , 0 , 0);
+        }
+        // @return : owner haplotype or -1 .
+        int FindAt(uint64_t key , uint64_t index) const {
+            if( index == Mphf::NONE ) return -1 ;
+            uint64_t bit = index * width ;
+            const uint64_t * w = entries + bit / 64 ;
+            uint64_t v = w[0] >> ( bit % 64 );
+            if( bit % 64 + width > 64 ) v |= w[1] << ( 64 - bit % 64 );
+            v &= mask ;
+            if( ( v & ( ( 1ULL << fp_bits ) - 1 ) ) != Fingerprint(key,fp_bits) ) return -1 ;
+            return v >> fp_bits ;
+        }
+        int Find(uint64_t key) const { return FindAt(key,Index(key)); }
+
+    private:
+        static uint64_t Fingerprint(uint64_t key , int bits){
+            return bits == 0 ? 0 : key >> ( 64 - bits ) ;
+        }
+
+        std::vector<uint64_t> storage;
+        const uint64_t * data ;
+        size_t word_num ;
+        Mphf mphf ;
+        const uint64_t * entries ;
+        int fp_bits ;
+        int width ;
+        uint64_t mask ;
+};
+#endif
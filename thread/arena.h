@@ -0,0 +1,62 @@
+#ifndef THREAD_ARENA_H
+#define THREAD_ARENA_H
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+//
+// bump allocator : small objects are cut from large blocks one after
+//   another and are all released together with the arena , there is no
+//   free of one object and no heap call per object .
+//   one owner at a time , not thread safe .
+//
+class Arena {
+    public:
+        explicit Arena(size_t block = 1 << 20)
+            : block_size(block) , cur(NULL) , left(0) , total(0) {}
+        ~Arena() { for( char * block : blocks ) free(block); }
+        Arena(const Arena &) = delete ;
+        Arena & operator=(const Arena &) = delete ;
+
+        // @return : n bytes aligned by align , kept until the arena is gone
+        void * Alloc(size_t n , size_t align = alignof(std::max_align_t)){
+            size_t pad = cur == NULL ? 0 : ( align - (uintptr_t)cur % align ) % align ;
+            if( cur == NULL || pad + n > left ) {
+                size_t size = std::max(block_size , n + align);
+                cur = (char *)malloc(size);
+                if( cur == NULL ) {
+                    std::cerr<<"ERROR : failed to allocate "<<size<<" bytes arena block , exit ..."<<std::endl;
+                    exit(1);
+                }
+                blocks.push_back(cur);
+                left = size ;
+                total += size ;
+                pad = ( align - (uintptr_t)cur % align ) % align ;
+            }
+            char * p = cur + pad ;
+            cur = p + n ;
+            left -= pad + n ;
+            return p ;
+        }
+        // @return : a copy of str[0,len) , '\0' terminated
+        const char * Copy(const char * str , size_t len){
+            char * p = (char *)Alloc(len + 1 , 1);
+            memcpy(p,str,len);
+            p[len] = '\0' ;
+            return p ;
+        }
+        // bytes of all blocks
+        size_t Bytes() const { return total ; }
+
+    private:
+        size_t block_size ;
+        char * cur ;
+        size_t left ;
+        size_t total ;
+        std::vector<char *> blocks ;
+};
+#endif
@@ -0,0 +1,46 @@
+#ifndef THREAD_ATOMIC_BITMAP_H
+#define THREAD_ATOMIC_BITMAP_H
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+
+//
+// bitmap shared by threads , bits are only set , never cleared .
+//   memory is reserved by an anonymous mmap without swap reservation , so a
+//   bitmap of all 2^32 ids costs only the pages really touched .
+//   Set / Test are relaxed atomics : a reader may miss a bit set just now ,
+//   which only delays its effect .
+//
+class AtomicBitmap {
+    public:
+        explicit AtomicBitmap(uint64_t bits){
+            bytes = ( ( bits + 63 ) / 64 ) * sizeof(uint64_t) ;
+            void * addr = mmap(NULL,bytes,PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+            if( addr == MAP_FAILED ) {
+                std::cerr<<"ERROR : failed to mmap "<<bytes<<" bytes bitmap , exit ..."<<std::endl;
+                exit(1);
+            }
+            words = (uint64_t *)addr ;
+        }
+        ~AtomicBitmap() { munmap(words,bytes); }
+
+        void Set(uint64_t i){
+            uint64_t m = 1ULL << ( i % 64 );
+            // skip the write if set , keep the cache line shared
+            if( ! ( __atomic_load_n(words + i / 64 , __ATOMIC_RELAXED) & m ) )
+                __atomic_fetch_or(words + i / 64 , m , __ATOMIC_RELAXED);
+        }
+        bool Test(uint64_t i) const {
+            return ( __atomic_load_n(words + i / 64 , __ATOMIC_RELAXED) >> ( i % 64 ) ) & 1 ;
+        }
+
+    private:
+        AtomicBitmap(const AtomicBitmap &);
+        AtomicBitmap & operator=(const AtomicBitmap &);
+        uint64_t * words ;
+        size_t bytes ;
+};
+#endif
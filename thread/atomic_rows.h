@@ -0,0 +1,111 @@
+#ifndef THREAD_ATOMIC_ROWS_H
+#define THREAD_ATOMIC_ROWS_H
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+
+//
+// uint32 key -> row of cols atomic uint32 counts , shared by threads , lock free.
+//   keys are only inserted , never erased . the table is a list of levels ,
+//   level l has 2^(FIRST_BITS+l) slots and is made when it is first needed .
+//   a key lives in the first level with a free slot among the PROBES slots
+//   after its hash , a slot goes from empty to a key once only , so once the
+//   PROBES slots of a key are all taken by others they stay so , and every
+//   thread puts the same key into the same slot .
+//   levels are anonymous mmap without swap reservation , untouched slots
+//   cost nothing . a slot keeps key ^ empty , so a zero page is empty slots
+//   with zero counts .
+//
+class AtomicRows {
+    public:
+        static const int FIRST_BITS = 20 ;
+        static const int LEVELS = 12 ;
+        static const int PROBES = 16 ;
+
+        AtomicRows(int c , uint32_t empty) : cols(c) , empty_key(empty) , used(0) {
+            for( int l = 0 ; l < LEVELS ; l ++ ) levels[l].store(NULL);
+        }
+        ~AtomicRows(){
+            for( int l = 0 ; l < LEVELS ; l ++ ) {
+                Level * level = levels[l].load();
+                if( level == NULL ) continue ;
+                munmap(level->keys,level->bytes);
+                delete level ;
+            }
+        }
+
+        // find or create the row of key
+        std::atomic<uint32_t> * Row(uint32_t key , uint64_t hash){
+            for( int l = 0 ; l < LEVELS ; l ++ ) {
+                Level * level = GetLevel(l);
+                size_t i = hash & level->mask ;
+                uint32_t stored = key ^ empty_key ;
+                for( int p = 0 ; p < PROBES ; p ++ , i = ( i + 1 ) & level->mask ) {
+                    uint32_t k = level->keys[i].load(std::memory_order_acquire);
+                    if( k == 0 ) {
+                        // a failed exchange loads the winner into k
+                        if( level->keys[i].compare_exchange_strong(k,stored,std::memory_order_acq_rel) ) {
+                            used.fetch_add(1,std::memory_order_relaxed);
+                            return level->counts + i * cols ;
+                        }
+                    }
+                    if( k == stored ) return level->counts + i * cols ;
+                }
+            }
+            std::cerr<<"ERROR : shared rows are full , exit ..."<<std::endl;
+            exit(1);
+        }
+        size_t Size() const { return used.load(std::memory_order_relaxed) ; }
+        // f(key,counts) for every row , call it when no thread is adding
+        template<class F>
+        void ForEach(F f) const {
+            for( int l = 0 ; l < LEVELS ; l ++ ) {
+                const Level * level = levels[l].load();
+                if( level == NULL ) continue ;
+                for( size_t i = 0 ; i <= level->mask ; i ++ ) {
+                    uint32_t k = level->keys[i].load(std::memory_order_relaxed);
+                    if( k != 0 ) f(k ^ empty_key,level->counts + i * cols);
+                }
+            }
+        }
+
+    private:
+        struct Level {
+            std::atomic<uint32_t> * keys ;
+            std::atomic<uint32_t> * counts ;   // slots * cols
+            size_t mask ;
+            size_t bytes ;
+        };
+        Level * GetLevel(int l){
+            Level * level = levels[l].load(std::memory_order_acquire);
+            if( level != NULL ) return level ;
+            Level * made = new Level();
+            size_t slots = (size_t)1 << ( FIRST_BITS + l ) ;
+            made->mask = slots - 1 ;
+            made->bytes = slots * ( cols + 1 ) * sizeof(uint32_t) ;
+            void * addr = mmap(NULL,made->bytes,PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+            if( addr == MAP_FAILED ) {
+                std::cerr<<"ERROR : failed to mmap "<<made->bytes<<" bytes of shared rows , exit ..."<<std::endl;
+                exit(1);
+            }
+            made->keys = (std::atomic<uint32_t> *)addr ;
+            made->counts = made->keys + slots ;
+            if( levels[l].compare_exchange_strong(level,made,std::memory_order_acq_rel) )
+                return made ;
+            munmap(addr,made->bytes);
+            delete made ;
+            return level ;
+        }
+        AtomicRows(const AtomicRows &);
+        AtomicRows & operator=(const AtomicRows &);
+
+        int cols ;
+        uint32_t empty_key ;
+        std::atomic<size_t> used ;
+        std::atomic<Level *> levels[LEVELS];
+};
+#endif
@@ -0,0 +1,164 @@
+#ifndef THREAD_MPMC_QUEUE_H
+#define THREAD_MPMC_QUEUE_H
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <thread>
+#include <cstddef>
+#include <cassert>
+
+//
+// bounded lock-free multi-producer multi-consumer queue ( D. Vyukov ).
+//   each cell carries a sequence number telling whether it is ready to
+//   be written or read in the current lap , so push / pop are one CAS .
+//
+// Push / Pop block when the queue is full / empty : spin a little , then
+// sleep on a condition variable . the lock is only touched when someone
+// really sleeps .
+//
+template<class T>
+class MPMCQueue {
+    public:
+        explicit MPMCQueue(size_t capacity)
+            : cells(RoundUp(capacity)) , closed(false) , push_waiters(0) , pop_waiters(0) {
+            for( size_t i = 0 ; i < cells.size() ; i ++ )
+                cells[i].seq.store(i,std::memory_order_relaxed);
+            mask = cells.size() - 1 ;
+            enqueue_pos.store(0,std::memory_order_relaxed);
+            dequeue_pos.store(0,std::memory_order_relaxed);
+        }
+
+        bool TryPush(T & data){
+            Cell * cell ;
+            size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+            while(true){
+                cell = &cells[pos & mask];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                if( diff == 0 ) {
+                    if( enqueue_pos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed) )
+                        break;
+                } else if ( diff < 0 )
+                    return false ;
+                else
+                    pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+            cell->data = std::move(data);
+            cell->seq.store(pos+1,std::memory_order_release);
+            return true ;
+        }
+
+        bool TryPop(T & data){
+            Cell * cell ;
+            size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+            while(true){
+                cell = &cells[pos & mask];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+                if( diff == 0 ) {
+                    if( dequeue_pos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed) )
+                        break;
+                } else if ( diff < 0 )
+                    return false ;
+                else
+                    pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+            data = std::move(cell->data);
+            cell->seq.store(pos+mask+1,std::memory_order_release);
+            return true ;
+        }
+
+        // block until there is room.
+        void Push(T data){
+            if( ! TryPush(data) )
+                Wait(push_waiters,not_full,[&](){ return TryPush(data); });
+            Wake(pop_waiters,not_empty);
+        }
+
+        // block until there is data.
+        // @return : false if the queue is closed and drained.
+        bool Pop(T & data){
+            bool got = TryPop(data)
+                || Wait(pop_waiters,not_empty,[&](){ return TryPop(data) ; });
+            if( got ) Wake(push_waiters,not_full);
+            return got ;
+        }
+
+        // no more Push , wake all consumers.
+        void Close(){
+            std::lock_guard<std::mutex> guard(lock);
+            closed.store(true);
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+
+        // approximate element number , for statistics only.
+        size_t Size() const {
+            size_t e = enqueue_pos.load(std::memory_order_relaxed);
+            size_t d = dequeue_pos.load(std::memory_order_relaxed);
+            return e > d ? e - d : 0 ;
+        }
+        size_t Capacity() const { return mask + 1 ; }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> seq;
+            T data;
+            Cell() : seq(0) , data() {}
+        };
+        static const int SPIN = 64 ;
+
+        static size_t RoundUp(size_t capacity){
+            size_t cap = 2 ;
+            while( cap < capacity ) cap <<= 1 ;
+            return cap ;
+        }
+
+        // @return : false if closed before done() succeeded.
+        template<class F>
+        bool Wait(std::atomic<int> & waiters , std::condition_variable & cv , F done){
+            for( int i = 0 ; i < SPIN ; i ++ ) {
+                if( done() ) return true ;
+                std::this_thread::yield();
+            }
+            std::unique_lock<std::mutex> guard(lock);
+            waiters ++ ;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while( ! done() ) {
+                if( closed.load() ) {
+                    // drain what is still in queue
+                    bool ret = done();
+                    waiters -- ;
+                    return ret ;
+                }
+                cv.wait(guard);
+            }
+            waiters -- ;
+            return true ;
+        }
+        void Wake(std::atomic<int> & waiters , std::condition_variable & cv){
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if( waiters.load() > 0 ) {
+                std::lock_guard<std::mutex> guard(lock);
+                cv.notify_one();
+            }
+        }
+
+        std::vector<Cell> cells;
+        size_t mask;
+        // hot positions are padded apart , not aligned : a queue inside a heap
+        // object is made by new , which keeps no alignment above 16 in c++11 .
+        char pad0[64];
+        std::atomic<size_t> enqueue_pos;
+        char pad1[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> dequeue_pos;
+        char pad2[64 - sizeof(std::atomic<size_t>)];
+        std::atomic<bool> closed;
+        std::atomic<int> push_waiters;
+        std::atomic<int> pop_waiters;
+        std::mutex lock;
+        std::condition_variable not_full;
+        std::condition_variable not_empty;
+};
+#endif
@@ -0,0 +1,132 @@
+#ifndef THREAD_TELEMETRY_H
+#define THREAD_TELEMETRY_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+
+//
+// run time counters :
+//   ThreadCounters   : one per thread , only its owner adds , by relaxed
+//                      load and store , so others read them without lock
+//                      and the owner pays no locked instruction . 64 bytes
+//                      of padding keep counters of two threads in an array
+//                      off one cache line , new[] gives no 64 bytes alignment .
+//   StageTimes       : wall time of the serial stages in run order .
+//   ProgressReporter : a thread calling back every interval seconds .
+//
+
+inline uint64_t nowNs(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// @return : peak resident set size in kB
+inline uint64_t peakRssKB(){
+    struct rusage usage ;
+    getrusage(RUSAGE_SELF,&usage);
+    return usage.ru_maxrss ;
+}
+
+// @return : resident set size in kB now , 0 if unknown
+inline uint64_t rssKB(){
+    unsigned long size = 0 , resident = 0 ;
+    FILE * fp = fopen("/proc/self/statm","r");
+    if( fp == NULL ) return 0 ;
+    if( fscanf(fp,"%lu %lu",&size,&resident) != 2 ) resident = 0 ;
+    fclose(fp);
+    return resident * ( sysconf(_SC_PAGESIZE) / 1024 );
+}
+
+struct ThreadCounters {
+    enum {
+        READS = 0 , BASES , BYTES , ROWS ,   // workers : input done , barcode rows
+        KMERS , HITS ,                       // workers : kmer lookups , hits
+        BUSY_NS , IDLE_NS ,                  // workers : processing , waiting jobs
+        PARSE_NS , STALL_NS ,                // producers : reading , waiting buffers
+        CHUNKS , DEPTH_SUM , DEPTH_MAX ,     // producers : queue depth at submit
+        NUM
+    };
+    std::atomic<uint64_t> values[NUM];
+    char pad[64];
+    ThreadCounters() { for( auto & v : values ) v.store(0,std::memory_order_relaxed); }
+
+    void Add(int i , uint64_t n){
+        values[i].store(values[i].load(std::memory_order_relaxed) + n , std::memory_order_relaxed);
+    }
+    void Set(int i , uint64_t n) { values[i].store(n,std::memory_order_relaxed); }
+    void Max(int i , uint64_t n) { if( n > Get(i) ) Set(i,n); }
+    uint64_t Get(int i) const { return values[i].load(std::memory_order_relaxed) ; }
+
+    // sum of counter i over n threads
+    static uint64_t Sum(const ThreadCounters * counters , int n , int i){
+        uint64_t sum = 0 ;
+        for( int t = 0 ; t < n ; t ++ ) sum += counters[t].Get(i);
+        return sum ;
+    }
+};
+
+class StageTimes {
+    public:
+        StageTimes() : start(nowNs()) , last(start) {}
+        // end the running stage as name
+        void Mark(const std::string & name){
+            uint64_t now = nowNs();
+            stages.push_back(std::make_pair(name,( now - last ) / 1e9));
+            last = now ;
+        }
+        double Elapsed() const { return ( nowNs() - start ) / 1e9 ; }
+        const std::vector<std::pair<std::string,double> > & Stages() const { return stages ; }
+
+    private:
+        uint64_t start , last ;
+        std::vector<std::pair<std::string,double> > stages ;
+};
+
+class ProgressReporter {
+    public:
+        // report( seconds since Start ) is called from another thread ,
+        // interval <= 0 reports nothing.
+        ProgressReporter(double interval , std::function<void(double)> report)
+            : seconds(interval) , callback(report) , stopped(false) , start(nowNs()) {
+            if( seconds > 0 )
+                thread = std::thread([this](){ Run(); });
+        }
+        ~ProgressReporter() { Stop(); }
+        void Stop(){
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                stopped = true ;
+            }
+            wake.notify_all();
+            if( thread.joinable() ) thread.join();
+        }
+
+    private:
+        void Run(){
+            std::unique_lock<std::mutex> guard(lock);
+            auto next = std::chrono::steady_clock::now();
+            while( true ) {
+                next += std::chrono::microseconds((long)( seconds * 1e6 ));
+                if( wake.wait_until(guard,next,[this](){ return stopped ; }) ) return ;
+                callback(( nowNs() - start ) / 1e9);
+            }
+        }
+        double seconds ;
+        std::function<void(double)> callback ;
+        bool stopped ;
+        uint64_t start ;
+        std::mutex lock ;
+        std::condition_variable wake ;
+        std::thread thread ;
+};
+#endif